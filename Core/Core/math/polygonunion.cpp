@@ -0,0 +1,223 @@
+#include <math/polygonunion.h>
+
+#include <clipper2/clipper.h>
+
+#include <boost/optional.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace core {
+namespace math {
+
+struct PolygonUnion::Imp
+{
+    Imp( double scale )
+        : scale( scale )
+    {
+    }
+
+    void setGroup( size_t id, const model::Polylines& polygons )
+    {
+        Clipper2Lib::Paths64 paths;
+        paths.reserve( polygons.size() );
+        for( const auto& polygon : polygons ) {
+            if( polygon.size() < 3 ) {
+                continue;
+            }
+            auto path = toPath( polygon );
+            // So that overlapping polygons never cancel each other out.
+            if( Clipper2Lib::Area( path ) < 0. ) {
+                std::reverse( path.begin(), path.end() );
+            }
+            paths.push_back( std::move( path ) );
+        }
+        if( id >= groups.size() ) {
+            groups.resize( id + 1 );
+        }
+        groups[ id ] = Clipper2Lib::Union( paths, Clipper2Lib::FillRule::NonZero );
+        unioned.reset();
+    }
+
+    void cacheUnion()
+    {
+        if( unioned ) {
+            return;
+        }
+        Clipper2Lib::Paths64 paths;
+        for( const auto& group : groups ) {
+            paths.insert( paths.end(), group.begin(), group.end() );
+        }
+        unioned.emplace();
+        unioned->paths = Clipper2Lib::Union( paths, Clipper2Lib::FillRule::NonZero );
+        unioned->bounds.reserve( unioned->paths.size() );
+        for( const auto& path : unioned->paths ) {
+            unioned->bounds.push_back( Clipper2Lib::GetBounds( path ) );
+        }
+    }
+
+    Clipper2Lib::Path64 toPath( const model::Polyline& poly ) const
+    {
+        Clipper2Lib::Path64 ret;
+        ret.reserve( poly.size() );
+        for( const auto& p : poly ) {
+            ret.emplace_back( static_cast< int64_t >( std::llround( p.x() * scale ) ),
+                              static_cast< int64_t >( std::llround( p.y() * scale ) ) );
+        }
+        return ret;
+    }
+
+    /// Return the parameter along 'path' of the point nearest 'p' on segments 'firstSeg' up to
+    /// (not including) 'endSeg'.
+    static double locate( const model::Polyline& path, const model::Pos& p, size_t firstSeg, size_t endSeg )
+    {
+        double bestDist = std::numeric_limits< double >::max();
+        double ret = static_cast< double >( firstSeg );
+        for( size_t i = firstSeg; i < endSeg && i + 1 < path.size(); i++ ) {
+            const auto& a = path[ i ];
+            const auto ab = path[ i + 1 ] - a;
+            const auto lenSq = model::Pos::dot( ab, ab );
+            const auto f = lenSq > 0. ? std::clamp( model::Pos::dot( p - a, ab ) / lenSq, 0., 1. ) : 0.;
+            const auto dist = ( a + ab * f - p ).length();
+            if( dist < bestDist ) {
+                bestDist = dist;
+                ret = static_cast< double >( i ) + f;
+            }
+        }
+        return ret;
+    }
+
+    std::vector< PolylineInterval > outsideIntervals( const model::Polyline& path, const std::vector< size_t >& ids ) const
+    {
+        std::vector< PolylineInterval > ret;
+        if( path.size() < 2 ) {
+            return ret;
+        }
+
+        auto subject = toPath( path );
+        Clipper2Lib::Clipper64 clipper;
+        bool anyClip = false;
+        if( unioned ) {
+            // A boundary whose bounds miss 'path''s cannot enclose any of it.
+            const auto subjectBounds = Clipper2Lib::GetBounds( subject );
+            Clipper2Lib::Paths64 near;
+            for( size_t i = 0; i < unioned->paths.size(); i++ ) {
+                if( unioned->bounds[ i ].Intersects( subjectBounds ) ) {
+                    near.push_back( unioned->paths[ i ] );
+                }
+            }
+            anyClip = !near.empty();
+            clipper.AddClip( near );
+        } else {
+            // Clipper2 winds every group's outer boundaries the same way (and holes the other way), so
+            // under 'NonZero' the groups taken together cover their union.
+            for( const auto id : ids ) {
+                if( id < groups.size() && !groups[ id ].empty() ) {
+                    clipper.AddClip( groups[ id ] );
+                    anyClip = true;
+                }
+            }
+        }
+        if( !anyClip ) {
+            ret.push_back( { 0., static_cast< double >( path.size() - 1 ) } );
+            return ret;
+        }
+
+        // Clipper2 returns the pieces in no particular order and may snap or drop 'path''s points, so
+        // trace each piece's ends back through 'z': 1 + the index of the 'path' point it is, or
+        // -(1 + the index in 'cuts' of the 'path' points whose segment(s) a clip edge cut there).
+        for( size_t i = 0; i < subject.size(); i++ ) {
+            subject[ i ].z = static_cast< int64_t >( i + 1 );
+        }
+        std::vector< std::array< size_t, 2 > > cuts;
+        clipper.SetZCallback( [ &cuts ]( const Clipper2Lib::Point64& subjectBot, const Clipper2Lib::Point64& subjectTop,
+                                         const Clipper2Lib::Point64&, const Clipper2Lib::Point64&, Clipper2Lib::Point64& pt )
+        {
+            // Clipper2 passes the subject's edge first; the clip groups' points all have 'z' 0.
+            if( pt.z > 0 || subjectBot.z <= 0 || subjectTop.z <= 0 ) {
+                return;
+            }
+            cuts.push_back( { static_cast< size_t >( std::min( subjectBot.z, subjectTop.z ) - 1 ),
+                              static_cast< size_t >( std::max( subjectBot.z, subjectTop.z ) - 1 ) } );
+            pt.z = -static_cast< int64_t >( cuts.size() );
+        } );
+        clipper.AddOpenSubject( { subject } );
+        Clipper2Lib::Paths64 unusedClosed;
+        Clipper2Lib::Paths64 pieces;
+        clipper.Execute( Clipper2Lib::ClipType::Difference, Clipper2Lib::FillRule::NonZero, unusedClosed, pieces );
+
+        const auto paramOf = [ & ]( const Clipper2Lib::Point64& pt )
+        {
+            if( pt.z > 0 ) {
+                return static_cast< double >( pt.z - 1 );
+            }
+            const model::Pos pos( static_cast< double >( pt.x ) / scale, static_cast< double >( pt.y ) / scale );
+            if( pt.z < 0 ) {
+                const auto& cut = cuts[ static_cast< size_t >( -pt.z - 1 ) ];
+                return locate( path, pos, cut[ 0 ], cut[ 1 ] );
+            }
+            return locate( path, pos, 0, path.size() - 1 );
+        };
+        for( const auto& piece : pieces ) {
+            if( piece.size() < 2 ) {
+                continue;
+            }
+            const auto fStart = paramOf( piece.front() );
+            const auto fEnd = paramOf( piece.back() );
+            ret.push_back( { std::min( fStart, fEnd ), std::max( fStart, fEnd ) } );
+        }
+
+        std::sort( ret.begin(), ret.end() );
+        std::vector< PolylineInterval > merged;
+        for( const auto& interval : ret ) {
+            if( !merged.empty() && interval[ 0 ] <= merged.back()[ 1 ] ) {
+                merged.back()[ 1 ] = std::max( merged.back()[ 1 ], interval[ 1 ] );
+            } else {
+                merged.push_back( interval );
+            }
+        }
+        return merged;
+    }
+
+    const double scale;
+    /// Indexed by group ID.
+    std::vector< Clipper2Lib::Paths64 > groups;
+
+    /// The union of all of 'groups', and the bounds of each of its paths.
+    struct Unioned
+    {
+        Clipper2Lib::Paths64 paths;
+        std::vector< Clipper2Lib::Rect64 > bounds;
+    };
+    /// Kept from 'cacheUnion' until the next 'setGroup'.
+    boost::optional< Unioned > unioned;
+};
+
+PolygonUnion::PolygonUnion( double scale )
+    : _imp( std::make_unique< Imp >( scale ) )
+{
+}
+
+PolygonUnion::~PolygonUnion()
+{
+}
+
+void PolygonUnion::setGroup( size_t id, const model::Polylines& polygons )
+{
+    _imp->setGroup( id, polygons );
+}
+
+void PolygonUnion::cacheUnion()
+{
+    _imp->cacheUnion();
+}
+
+std::vector< PolygonUnion::PolylineInterval > PolygonUnion::outsideIntervals( const model::Polyline& path,
+                                                                              const std::vector< size_t >& ids ) const
+{
+    return _imp->outsideIntervals( path, ids );
+}
+
+} // math
+} // core
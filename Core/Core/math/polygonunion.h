@@ -0,0 +1,45 @@
+#ifndef CORE_MATH_POLYGONUNION_H
+#define CORE_MATH_POLYGONUNION_H
+
+#include <Core/model/polyline.h>
+
+#include <array>
+#include <memory>
+#include <vector>
+
+namespace core {
+namespace math {
+
+/// The union of groups of polygons, against which polylines can be clipped. Each group is unioned
+/// (with Clipper2) on its own, so setting one group leaves the others alone. 'cacheUnion' also keeps
+/// the union of all the groups, which clipping then uses as is; without it (as after 'setGroup'),
+/// each clip costs a union of the groups asked for. Clipper2 works in integers, so coordinates are
+/// snapped to multiples of 1 / 'scale'.
+class PolygonUnion
+{
+public:
+    /// An interval of a polyline's parameter, where 'i + f' stands for the point 'f' (in [0,1]) of
+    /// the way from point 'i' to point 'i + 1'.
+    using PolylineInterval = std::array< double, 2 >;
+
+    /// 'scale' > 0. Start with no groups.
+    explicit PolygonUnion( double scale );
+    ~PolygonUnion();
+
+    /// Make group 'id' (replacing whatever it was) the union of 'polygons', each of which is
+    /// implicitly closed and may wind either way. Drop the cached union of all groups.
+    void setGroup( size_t id, const model::Polylines& polygons );
+    /// Union all the groups, unless that is already cached.
+    void cacheUnion();
+    /// Return, in increasing order, the non-overlapping intervals of 'path' (treated as open) that
+    /// lie outside the union of all groups, given that only groups 'ids' reach 'path'.
+    std::vector< PolylineInterval > outsideIntervals( const model::Polyline& path, const std::vector< size_t >& ids ) const;
+private:
+    struct Imp;
+    const std::unique_ptr< Imp > _imp;
+};
+
+} // math
+} // core
+
+#endif // #include
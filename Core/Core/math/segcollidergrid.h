@@ -1,23 +1,53 @@
 #ifndef CORE_MATH_SEGCOLLIDERGRID_H
 #define CORE_MATH_SEGCOLLIDERGRID_H
 
+#include <Core/exceptions/runtimeerror.h>
 #include <Core/model/boundingboxback.h>
 #include <Core/model/lineback.h>
 #include <Core/model/posback.h>
 
+#include <Core/math/segindextype.h>
+#include <Core/math/segquadtree.h>
+
 #include <Core/utility/intcoord.h>
 #include <Core/utility/mathutility.h>
+#include <Core/utility/parallelfor.h>
+#include <Core/utility/segmentbatch.h>
+#include <Core/utility/segmentcellwalker.h>
 #include <Core/utility/twodarray.h>
+#include <Core/utility/visitstamps.h>
 
 #include <boost/optional.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
 #include <set>
+#include <vector>
 
 namespace core {
 namespace math {
 
 /// Grid structure representing a rectangle of space in which line segments are stored, each with
 /// a 'Metadata', the purpose being to accelerate intersection detection.
+///
+/// Each added segment is stored once (in a pool); cells refer to it by 'SegIndex'. Cells have two
+/// layouts: an editable one (one index vector per cell, used by 'addSeg') and a frozen one (one
+/// offsets array plus one contiguous index array for the whole grid, built by 'bulkLoad'). Editing
+/// a frozen grid converts it back to the editable layout. In both layouts each cell also keeps a
+/// copy of its segments' coordinates in a 'SegmentBatch' parallel to its indices, so that
+/// 'forEachCellHit' can test many of them at once.
+///
+/// Removing segments only marks them dead in the pool (so it costs time in proportion to the number
+/// removed); queries skip dead entries, and cells are compacted once dead entries pile up. Dead
+/// segments keep their place in the pool (so every 'SegIndex' stays valid) until 'compactPool',
+/// which whoever holds on to 'SegIndex'es calls once 'poolIsSparse'.
+///
+/// With 'AdaptiveQuadtree', cells are instead the leaves of a 'SegQuadtree' (and there is no frozen
+/// layout). Code that should work with either kind of cell goes through 'forEachCellAlong' and
+/// friends rather than grid coordinates.
 template< typename Metadata >
 class SegColliderGrid
 {
@@ -33,14 +63,41 @@ public:
         Metadata metadata;
     };
     using SegsWithData = std::vector< SegWithData >;
-    using CellContents = SegsWithData;
+    /// Index of a stored segment in the pool.
+    using SegIndex = std::uint32_t;
+    using SegIndices = std::vector< SegIndex >;
+    /// Stands for "no segment".
+    static constexpr SegIndex noSegIndex = std::numeric_limits< SegIndex >::max();
+
+    /// The indices stored in one cell, in the order they were added.
+    class CellView
+    {
+    public:
+        CellView() = default;
+        CellView( const SegIndex* first, const SegIndex* last, const SegmentBatchView& coords )
+            : _first( first ), _last( last ), _coords( coords )
+        {
+        }
+        const SegIndex* begin() const { return _first; }
+        const SegIndex* end() const { return _last; }
+        size_t size() const { return static_cast< size_t >( _last - _first ); }
+        bool empty() const { return _first == _last; }
+        SegIndex operator[]( size_t i ) const { return _first[ i ]; }
+        /// The segments' coordinates, with the same order as the indices.
+        const SegmentBatchView& coords() const { return _coords; }
+    private:
+        const SegIndex* _first = nullptr;
+        const SegIndex* _last = nullptr;
+        SegmentBatchView _coords;
+    };
 
     /// A yes/no question re. the metadata associated with a stored line segment.
     using MetadataPredicate = std::function< bool( const Metadata& ) >;
     /// A yes/no question re. a 'Seg' and its associated 'Metadata'.
     using SWDPredicate = std::function< bool( const SegWithData& ) >;
 
-    SegColliderGrid( const model::BoundingBox& canvasBounds, int minCellsDim )
+    SegColliderGrid( const model::BoundingBox& canvasBounds, int minCellsDim, SegIndexType indexType = UniformGrid )
+        : _frozen( false )
     {
         _canvasRect = canvasBounds;
         const auto minDimCanvas = canvasBounds.minDim();
@@ -52,6 +109,77 @@ public:
         } else {
             _grid.recreate( minCellsDim, maxCellsDim );
         }
+        _gridCoords.recreate( _grid.width(), _grid.height() );
+        if( indexType == AdaptiveQuadtree ) {
+            _quadtree = std::make_unique< SegQuadtree >( canvasBounds );
+        }
+    }
+
+    using GridParams = SegGridParams;
+
+    GridParams gridParams() const
+    {
+        return GridParams{ _cellWidth, _grid.width(), _grid.height() };
+    }
+
+    /// Uniform grid only (throws otherwise), and only while 'this' holds no segments: make the cells 'cellWidth' wide,
+    /// or wider if that would make more than 'maxCells' of them.
+    void setCellWidth( double cellWidth, size_t maxCells )
+    {
+        if( indexType() != UniformGrid ) {
+            THROW_RUNTIME( "Only a uniform-grid SegColliderGrid has cells to resize" );
+        }
+        if( !_segs.empty() ) {
+            THROW_RUNTIME( "Cannot resize the cells of a non-empty SegColliderGrid" );
+        }
+        const double width = _canvasRect.widthExclusive();
+        const double height = _canvasRect.heightExclusive();
+        const auto numCells = [ & ]( double w )
+        {
+            return std::ceil( width / w ) * std::ceil( height / w );
+        };
+        cellWidth = std::max( cellWidth, std::sqrt( width * height / static_cast< double >( std::max< size_t >( maxCells, 1 ) ) ) );
+        // Rounding up to whole cells can still overshoot a little.
+        while( numCells( cellWidth ) > static_cast< double >( std::max< size_t >( maxCells, 1 ) ) ) {
+            cellWidth *= 1.01;
+        }
+
+        _cellWidth = cellWidth;
+        _grid.recreate( std::max( static_cast< int >( std::ceil( width / cellWidth ) ), 1 ),
+                        std::max( static_cast< int >( std::ceil( height / cellWidth ) ), 1 ) );
+        _gridCoords.recreate( _grid.width(), _grid.height() );
+        clear();
+    }
+
+    /// Return a cell width suited to 'segs' within 'canvasBounds': cells about twice as wide as the
+    /// 'percentile' (in [0,1]) segment length, so that a typical segment crosses few cells, but
+    /// widened if needed so there are at most a few cells per segment.
+    static double tunedCellWidth( const SegsWithData& segs, const model::BoundingBox& canvasBounds, double percentile = 0.5 )
+    {
+        std::vector< double > lengths;
+        lengths.reserve( segs.size() );
+        for( const auto& swd : segs ) {
+            const auto length = swd.seg.length();
+            if( length > 0. ) {
+                lengths.push_back( length );
+            }
+        }
+        if( lengths.empty() ) {
+            return canvasBounds.maxDim();
+        }
+        const auto nth = lengths.begin() + static_cast< std::ptrdiff_t >(
+            std::clamp( percentile, 0., 1. ) * static_cast< double >( lengths.size() - 1 ) );
+        std::nth_element( lengths.begin(), nth, lengths.end() );
+
+        const double lengthMultiple = 2.;
+        const double maxCellsPerSeg = 4.;
+        const double area = canvasBounds.widthExclusive() * canvasBounds.heightExclusive();
+        return std::max( *nth * lengthMultiple, std::sqrt( area / ( maxCellsPerSeg * static_cast< double >( lengths.size() ) ) ) );
+    }
+
+    SegIndexType indexType() const
+    {
+        return _quadtree ? AdaptiveQuadtree : UniformGrid;
     }
 
     const model::BoundingBox& bounds() const
@@ -65,32 +193,126 @@ public:
         return { int( p.x() ), int( p.y() ) };
     }
 
-    void addSeg( const Seg& seg, const Metadata& data, SetOfIPos* storeInvolvedCoords = nullptr )
+    /// Return the index under which 'seg' is stored. 'storeInvolvedCoords' (uniform grid only)
+    /// receives the coordinates of the cells that 'seg' was added to.
+    SegIndex addSeg( const Seg& seg, const Metadata& data, SetOfIPos* storeInvolvedCoords = nullptr )
     {
-        SegWithData swd;
-        swd.seg = seg;
-        swd.metadata = data;
+        thaw();
+
+        const auto idx = static_cast< SegIndex >( _segs.size() );
+        _segs.push_back( SegWithData{ seg, data } );
+        _segDead.push_back( false );
+        if( _quadtree ) {
+            _quadtree->insert( idx, seg );
+            return idx;
+        }
 
-        const auto coords = checkCoords( seg );
-        for( const auto& coord : coords ) {
+        forEachDilatedCoord( seg,
+        [ & ]( int x, int y )
+        {
+            auto& cell = _grid.getRef( x, y );
+            // Consecutive raster cells have overlapping dilations; store 'idx' once per cell.
+            if( cell.empty() || cell.back() != idx ) {
+                cell.push_back( idx );
+                _gridCoords.getRef( x, y ).push_back( seg );
+                if( storeInvolvedCoords ) {
+                    storeInvolvedCoords->emplace( x, y );
+                }
+            }
+        } );
+        return idx;
+    }
 
-            const auto x = coord.x();
-            const auto y = coord.y();
+    /// Replace the contents of 'this' with 'segs' (whose order determines their 'SegIndex'es)
+    /// and (uniform grid only) lay the grid out in the frozen layout. Cells are sized in a counting pass and then
+    /// filled in a second pass, so each of the frozen layout's arrays is allocated once.
+    void bulkLoad( SegsWithData&& segs )
+    {
+        clear();
+        _segs = std::move( segs );
+        _segDead.assign( _segs.size(), false );
+        if( _quadtree ) {
+            for( SegIndex idx = 0; idx < static_cast< SegIndex >( _segs.size() ); idx++ ) {
+                _quadtree->insert( idx, _segs[ idx ].seg );
+            }
+            return;
+        }
 
-            // Dilate the new info 3x3
-            for( int x2 = x - 1; x2 <= x + 1; x2++ ) {
-                for( int y2 = y - 1; y2 <= y + 1; y2++ ) {
-                    const IPos coord( x2, y2 );
-                    if( _grid.isValidCoord( coord ) ) {
-                        auto& cell = _grid.getRef( coord );
-                        cell.push_back( swd );
-                        if( storeInvolvedCoords ) {
-                            storeInvolvedCoords->emplace( coord );
-                        }
+        const size_t numCells = static_cast< size_t >( _grid.width() ) * static_cast< size_t >( _grid.height() );
+        const auto numPooled = static_cast< SegIndex >( _segs.size() );
+        const SegIndex noSeg = std::numeric_limits< SegIndex >::max();
+
+        // Count
+        _cellStart.assign( numCells + 1, 0 );
+        {
+            // The last segment counted in each cell (for skipping overlapping dilations).
+            SegIndices lastCounted( numCells, noSeg );
+            for( SegIndex idx = 0; idx < numPooled; idx++ ) {
+                forEachDilatedCoord( _segs[ idx ].seg,
+                [ & ]( int x, int y )
+                {
+                    const auto cellIdx = cellIndex( x, y );
+                    if( lastCounted[ cellIdx ] != idx ) {
+                        lastCounted[ cellIdx ] = idx;
+                        _cellStart[ cellIdx + 1 ]++;
                     }
-                }
+                } );
+            }
+        }
+        for( size_t i = 0; i < numCells; i++ ) {
+            _cellStart[ i + 1 ] += _cellStart[ i ];
+        }
+
+        // Fill
+        _cellSegs.resize( _cellStart.back() );
+        _cellSegCoords.resize( _cellStart.back() );
+        {
+            SegIndices cursor( _cellStart.begin(), _cellStart.end() - 1 );
+            for( SegIndex idx = 0; idx < numPooled; idx++ ) {
+                forEachDilatedCoord( _segs[ idx ].seg,
+                [ & ]( int x, int y )
+                {
+                    const auto cellIdx = cellIndex( x, y );
+                    auto& pos = cursor[ cellIdx ];
+                    if( pos == _cellStart[ cellIdx ] || _cellSegs[ pos - 1 ] != idx ) {
+                        _cellSegCoords.set( pos, _segs[ idx ].seg );
+                        _cellSegs[ pos++ ] = idx;
+                    }
+                } );
             }
         }
+        _frozen = true;
+    }
+
+    /// Return whether 'this' currently uses the frozen layout (see 'bulkLoad').
+    bool frozen() const
+    {
+        return _frozen;
+    }
+
+    /// Uniform grid only.
+    CellView cell( int x, int y ) const
+    {
+        if( _frozen ) {
+            const auto cellIdx = cellIndex( x, y );
+            const auto first = _cellStart[ cellIdx ];
+            const auto last = _cellStart[ cellIdx + 1 ];
+            const auto* const data = _cellSegs.data();
+            return CellView( data + first, data + last, _cellSegCoords.view( first, last ) );
+        } else {
+            const auto& indices = _grid.getRef( x, y );
+            return CellView( indices.data(), indices.data() + indices.size(), _gridCoords.getRef( x, y ).view() );
+        }
+    }
+
+    CellView cell( const IPos& coord ) const
+    {
+        return cell( coord.x(), coord.y() );
+    }
+
+    const SegWithData& segWithData( SegIndex idx ) const
+    {
+        return _segs[ idx ];
     }
 
     /// Return whether the line segment 'a'->'b' hits any stored line segment
@@ -98,70 +320,318 @@ public:
     bool hitsAny( const Pos& a, const Pos& b, SWDPredicate include ) const
     {
         const Seg aToB{ a, b };
-        const auto coordsToCheck = checkCoords( aToB );
-        for( const auto& coord : coordsToCheck ) {
-            if( _grid.isValidCoord( coord ) ) {
-                const auto& bin = _grid.getRef( coord );
-                for( const auto& swd : bin ) {
-                    if( include && !include( swd ) ) {
-                        continue;
-                    }
-                    const auto& seg = swd.seg;
-                    Pos hit;
-                    if( core::mathUtility::segmentsIntersect( aToB, seg, hit ) ) {
-                        return true;
-                    }
-                }
-            }
-        }
-        return false;
+        return !forEachCellAlong( aToB,
+        [ & ]( const CellView& bin )
+        {
+            return forEachCellHit( aToB, bin, 0,
+            [ & ]( SegIndex idx, const Pos& )
+            {
+                // Keep looking only past hits that 'include' rejects.
+                return include && !include( _segs[ idx ] );
+            } );
+        } );
     }
 
     void clear()
     {
         _grid.forEveryPos(
-        []( CellContents& bin )
+        []( SegIndices& bin )
         {
             bin.clear();
         } );
+        _gridCoords.forEveryPos(
+        []( SegmentBatch& coords )
+        {
+            coords.clear();
+        } );
+        _segs.clear();
+        _segDead.clear();
+        _numDead = 0;
+        _numDeadInCells = 0;
+        _cellStart.clear();
+        _cellSegs.clear();
+        _cellSegCoords.clear();
+        _frozen = false;
+        if( _quadtree ) {
+            _quadtree->clear();
+        }
     }
 
+    /// Return the number of (segment, cell) entries, including those of removed segments that have
+    /// not been compacted away yet.
     size_t numSegs() const
     {
+        if( _quadtree ) {
+            return _quadtree->numEntries();
+        }
+        if( _frozen ) {
+            return _cellSegs.size();
+        }
         size_t ret = 0;
         _grid.forEveryPos(
-        [ &ret ]( const CellContents& bin )
+        [ &ret ]( const SegIndices& bin )
         {
             ret += bin.size();
         } );
         return ret;
     }
 
+    /// Return whether there are no (unremoved) segments.
     bool empty() const
     {
-        return numSegs() == 0;
+        return _segs.size() == _numDead;
     }
 
     /// Remove all stored segments whose metadata satisfies 'removeIfTrue'.
     void removeSegs( MetadataPredicate removeIfTrue )
     {
-        _grid.forEveryPos(
-        [ &removeIfTrue ]( CellContents& bin )
-        {
-            CellContents filtered;
-            for( const auto& pair : bin ) {
-                if( !removeIfTrue( pair.metadata ) ) {
-                    filtered.push_back( pair );
+        for( SegIndex idx = 0; idx < static_cast< SegIndex >( _segs.size() ); idx++ ) {
+            if( !_segDead[ idx ] && removeIfTrue( _segs[ idx ].metadata ) ) {
+                markDead( idx );
+            }
+        }
+        compactIfSparse();
+    }
+
+    /// Remove the segments stored under 'indices' (which must not have been removed already).
+    void removeSegs( const SegIndices& indices )
+    {
+        for( const auto idx : indices ) {
+            markDead( idx );
+        }
+        compactIfSparse();
+    }
+
+    /// Return whether removed segments make up at least half of the pool (and enough of it for
+    /// 'compactPool' to pay off).
+    bool poolIsSparse() const
+    {
+        return _numDead >= minDeadToCompact && _numDead >= _segs.size() - _numDead;
+    }
+
+    /// Drop the removed segments from the pool and the cells, renumbering the rest in order, and
+    /// return the new 'SegIndex' of each old one ('noSegIndex' for the removed ones).
+    SegIndices compactPool()
+    {
+        SegIndices oldToNew( _segs.size(), noSegIndex );
+        SegIndex numLive = 0;
+        for( SegIndex idx = 0; idx < static_cast< SegIndex >( _segs.size() ); idx++ ) {
+            if( !_segDead[ idx ] ) {
+                oldToNew[ idx ] = numLive;
+                if( numLive != idx ) {
+                    _segs[ numLive ] = std::move( _segs[ idx ] );
                 }
+                numLive++;
             }
-            bin = filtered;
-        } );
+        }
+        compactCells( &oldToNew );
+
+        _segs.resize( numLive );
+        _segDead.assign( numLive, false );
+        _numDead = 0;
+        return oldToNew;
+    }
+
+    /// Return whether the segment stored under 'idx' has not been removed.
+    bool live( SegIndex idx ) const
+    {
+        return !_segDead[ idx ];
     }
 
     /// Return the distance from 'posCanvas' to the nearest segment satisfying 'segsToConsider' (which can be nullptr) that is closer
     /// than 'maxDistAllowed' (whose purpose is to reduce computation time as much as possible). Return boost::none if no match found.
+    ///
+    /// Cells are searched outwards from 'posCanvas', stopping as soon as no unsearched cell can
+    /// hold anything closer than the best match so far, and each segment is measured only once.
     boost::optional< double > distToNearestSeg( const Pos& posCanvas, MetadataPredicate segsToConsider, double maxDistAllowed ) const
     {
+        ThreadVisitStamps seenSegs( _segs.size() );
+        return distToNearestSeg( posCanvas, segsToConsider, maxDistAllowed, *seenSegs );
+    }
+
+    /// 'distToNearestSeg' for each of 'positions' in turn, with 'maxDistsAllowed' parallel to
+    /// 'positions'. Large batches are split among threads, so 'segsToConsider' must be safe to
+    /// call concurrently.
+    std::vector< boost::optional< double > > distsToNearestSeg( const std::vector< Pos >& positions, MetadataPredicate segsToConsider,
+                                                                const std::vector< double >& maxDistsAllowed ) const
+    {
+        std::vector< boost::optional< double > > ret( positions.size() );
+        const auto query = [ & ]( size_t, size_t begin, size_t end )
+        {
+            ThreadVisitStamps seenSegs( _segs.size() );
+            for( auto i = begin; i < end; i++ ) {
+                seenSegs->startPass( _segs.size() );
+                ret[ i ] = distToNearestSeg( positions[ i ], segsToConsider, maxDistsAllowed[ i ], *seenSegs );
+            }
+        };
+
+        const size_t minPerChunk = 256;
+        const auto numChunks = positions.size() / minPerChunk;
+        if( numChunks < 2 ) {
+            query( 0, 0, positions.size() );
+        } else {
+            parallelForChunks( positions.size(), numChunks, query );
+        }
+        return ret;
+    }
+
+protected:
+    /// Call 'f( bin )' for every cell that 'seg' passes through (in no particular order), stopping if
+    /// it returns false. Return false iff stopped.
+    template< typename F >
+    bool forEachCellAlong( const Seg& seg, F&& f ) const
+    {
+        if( _quadtree ) {
+            return _quadtree->forEachLeafAlong( seg,
+            [ & ]( const SegQuadtree::Node& leaf )
+            {
+                return f( leafView( leaf ) );
+            } );
+        }
+        const auto coordsToCheck = checkCoords( seg );
+        for( const auto& coord : coordsToCheck ) {
+            if( _grid.isValidCoord( coord ) && !f( cell( coord ) ) ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Call 'f( bin, fEnter )' for the cells that 'seg' passes through in the order it enters them
+    /// ('fEnter' is the fraction of the way along 'seg'), stopping if 'f' returns false.
+    template< typename F >
+    void forEachCellAlongInOrder( const Seg& seg, F&& f ) const
+    {
+        if( _quadtree ) {
+            _quadtree->forEachLeafAlongInOrder( seg,
+            [ & ]( const SegQuadtree::Node& leaf, double fEnter )
+            {
+                return f( leafView( leaf ), fEnter );
+            } );
+            return;
+        }
+        for( auto walker = cellWalker( seg ); !walker.done(); walker.advance() ) {
+            const auto& coord = walker.cell();
+            if( _grid.isValidCoord( coord ) && !f( cell( coord ), walker.fEnter() ) ) {
+                return;
+            }
+        }
+    }
+
+    /// Call 'f( bin )' for every cell.
+    template< typename F >
+    void forEachCell( F&& f ) const
+    {
+        if( _quadtree ) {
+            _quadtree->forEachLeaf(
+            [ & ]( const SegQuadtree::Node& leaf )
+            {
+                f( leafView( leaf ) );
+            } );
+            return;
+        }
+        for( int x = 0; x < _grid.width(); x++ ) {
+            for( int y = 0; y < _grid.height(); y++ ) {
+                f( cell( x, y ) );
+            }
+        }
+    }
+
+    /// Cells (for 'AdaptiveQuadtree', quadtree nodes, the non-leaves looking empty) can also be
+    /// addressed by number, from 0 up to 'numCells() - 1', e.g. to divide them among threads.
+    size_t numCells() const
+    {
+        if( _quadtree ) {
+            return _quadtree->numNodes();
+        }
+        return static_cast< size_t >( _grid.width() ) * static_cast< size_t >( _grid.height() );
+    }
+
+    CellView cellAt( size_t c ) const
+    {
+        if( _quadtree ) {
+            const auto& node = _quadtree->node( c );
+            return node.isLeaf() ? leafView( node ) : CellView();
+        }
+        const auto width = static_cast< size_t >( _grid.width() );
+        return cell( static_cast< int >( c % width ), static_cast< int >( c / width ) );
+    }
+
+    /// Return whether 'p' belongs to cell 'c'. Every point belongs to exactly one cell (points
+    /// outside the canvas to the nearest one), and any stored segment passing through 'p'
+    /// is in that cell.
+    bool cellOwns( size_t c, const Pos& p ) const
+    {
+        if( _quadtree ) {
+            const auto& node = _quadtree->node( c );
+            return node.isLeaf() && _quadtree->owns( node, p );
+        }
+        const auto width = static_cast< size_t >( _grid.width() );
+        const auto arrayP = arrayPos( p );
+        const auto x = std::clamp( static_cast< int >( std::floor( arrayP.x() ) ), 0, _grid.width() - 1 );
+        const auto y = std::clamp( static_cast< int >( std::floor( arrayP.y() ) ), 0, _grid.height() - 1 );
+        return static_cast< size_t >( x ) == c % width && static_cast< size_t >( y ) == c / width;
+    }
+
+    /// Call 'f( bin )' for every cell of a neighborhood guaranteed to include everything within
+    /// 'range' of any point in the uniform-grid cell 'xy'.
+    template< typename F >
+    void forEachCellNear( const IPos& xy, double range, F&& f ) const
+    {
+        if( _quadtree ) {
+            const auto topLeft = _canvasRect.topLeft();
+            const double xMin = topLeft.x() + xy.x() * _cellWidth - range;
+            const double yMin = topLeft.y() + xy.y() * _cellWidth - range;
+            _quadtree->forEachLeafInBox( xMin, yMin, xMin + _cellWidth + range * 2., yMin + _cellWidth + range * 2.,
+            [ & ]( const SegQuadtree::Node& leaf )
+            {
+                f( leafView( leaf ) );
+            } );
+            return;
+        }
+        const auto cx = xy.x();
+        const auto cy = xy.y();
+        const int halfNW = static_cast< int >( neighborhoodWidth( range ) ) / 2;
+        for( int x = cx - halfNW; x <= cx + halfNW; x++ ) {
+            for( int y = cy - halfNW; y <= cy + halfNW; y++ ) {
+                if( _grid.isValidCoord( x, y ) ) {
+                    f( cell( x, y ) );
+                }
+            }
+        }
+    }
+
+    static CellView leafView( const SegQuadtree::Node& leaf )
+    {
+        const auto* const data = leaf.indices.data();
+        return CellView( data, data + leaf.indices.size(), leaf.coords.view() );
+    }
+
+    /// 'distToNearestSeg', where 'seenSegs' must have been started on a new pass.
+    boost::optional< double > distToNearestSeg( const Pos& posCanvas, const MetadataPredicate& segsToConsider, double maxDistAllowed,
+                                                VisitStamps& seenSegs ) const
+    {
+        if( _quadtree ) {
+            return distToNearestSeg_quadtree( posCanvas, segsToConsider, maxDistAllowed, seenSegs );
+        }
+
+        boost::optional< double > closestDist;
+        const auto consider = [ & ]( SegIndex idx )
+        {
+            if( _segDead[ idx ] || !seenSegs.visit( idx ) ) {
+                return;
+            }
+            const auto& pair = _segs[ idx ];
+            if( !segsToConsider || segsToConsider( pair.metadata ) ) {
+                const auto& seg = pair.seg;
+                double storeDist = 0.;
+                core::mathUtility::closestPointOnLineSegment( posCanvas, seg.a, seg.b, storeDist );
+                if( !closestDist || storeDist < *closestDist ) {
+                    closestDist = storeDist;
+                }
+            }
+        };
+
         int centerX = 0;
         int centerY = 0;
         {
@@ -175,10 +645,17 @@ public:
         const auto maxNeighborhoodWidth = neighborhoodWidth( maxDistAllowed );
 
         // Move through neighborhoods 1X1, 3X3, 5X5... up to 'maxNeighborhoodWidth', looking for any marked positions.
-        boost::optional< double > closestDist;
         for( size_t neighborhoodWidth = 1; neighborhoodWidth <= maxNeighborhoodWidth; neighborhoodWidth += 2 ) {
 
             const int halfMinOne = static_cast< int >( neighborhoodWidth ) / 2;
+
+            // Every point of this ring is at least 'halfMinOne - 1' cells from 'posCanvas', and any
+            // segment's nearest point to 'posCanvas' lies in a cell holding that segment, so once that is
+            // farther than the best match, the rings already searched held the nearest segment.
+            if( closestDist && static_cast< double >( halfMinOne - 1 ) * _cellWidth > *closestDist ) {
+                break;
+            }
+
             const int left = centerX - halfMinOne;
             const int top = centerY - halfMinOne;
             const int right = centerX + halfMinOne;
@@ -205,24 +682,42 @@ public:
                 if( !_grid.isValidCoord( x, y ) ) {
                     continue;
                 }
-                const auto& bin = _grid.getRef( x, y );
-                for( const auto& pair : bin ) {
-                    if( !segsToConsider || segsToConsider( pair.metadata ) ) {
-                        // We've found a segment.
-                        const auto& seg = pair.seg;
-                        double storeDist = 0.;
-                        core::mathUtility::closestPointOnLineSegment( posCanvas, seg.a, seg.b, storeDist );
-                        if( !closestDist.is_initialized() || storeDist < closestDist ) {
-                            closestDist = storeDist;
-                        }
-                    }
+                for( const auto idx : cell( x, y ) ) {
+                    consider( idx );
                 }
             }
         }
         return closestDist;
     }
 
-protected:
+    boost::optional< double > distToNearestSeg_quadtree( const Pos& posCanvas, const MetadataPredicate& segsToConsider, double maxDistAllowed,
+                                                         VisitStamps& seenSegs ) const
+    {
+        boost::optional< double > closestDist;
+        _quadtree->forEachLeafByDistance( posCanvas,
+        [ & ]( const SegQuadtree::Node& leaf, double boxDist )
+        {
+            if( boxDist > maxDistAllowed || ( closestDist && boxDist > *closestDist ) ) {
+                return false;
+            }
+            for( const auto idx : leaf.indices ) {
+                const auto& pair = _segs[ idx ];
+                if( _segDead[ idx ] || !seenSegs.visit( idx ) ) {
+                    continue;
+                }
+                if( !segsToConsider || segsToConsider( pair.metadata ) ) {
+                    double storeDist = 0.;
+                    core::mathUtility::closestPointOnLineSegment( posCanvas, pair.seg.a, pair.seg.b, storeDist );
+                    if( !closestDist || storeDist < *closestDist ) {
+                        closestDist = storeDist;
+                    }
+                }
+            }
+            return true;
+        } );
+        return closestDist;
+    }
+
     /// Return the size (an odd number in cells) of a square neighborhood s.t. if there is a point 'p'
     /// anywhere in the neighborhood's center cell, then there is no point 'q' within 'range' or 'p'
     /// that does not fall in the neighborhood.
@@ -252,7 +747,210 @@ protected:
         return core::rasterizeSegment_floatingPoint( start, end );
     }
 
-    core::TwoDArray< CellContents > _grid;
+    /// Return a walker over the (in-grid) cells that 'seg' passes through, in order from 'seg.a'.
+    /// Its 'fEnter' values are fractions of the way along 'seg'.
+    SegmentCellWalker cellWalker( const Seg& seg ) const
+    {
+        return SegmentCellWalker( arrayPos( seg.a ), arrayPos( seg.b ), _grid.width(), _grid.height() );
+    }
+
+    /// Call 'f( x, y )' for every valid cell in the 3x3 dilation of each cell that 'seg' rasterizes to.
+    /// A cell may be visited more than once.
+    template< typename F >
+    void forEachDilatedCoord( const Seg& seg, F&& f ) const
+    {
+        const auto coords = checkCoords( seg );
+        for( const auto& coord : coords ) {
+            const auto x = coord.x();
+            const auto y = coord.y();
+            for( int x2 = x - 1; x2 <= x + 1; x2++ ) {
+                for( int y2 = y - 1; y2 <= y + 1; y2++ ) {
+                    if( _grid.isValidCoord( x2, y2 ) ) {
+                        f( x2, y2 );
+                    }
+                }
+            }
+        }
+    }
+
+    /// Call 'f( idx, hitPos )', in cell order, for each live segment in 'bin' from position 'first' on that
+    /// 'hitter' intersects (at 'hitPos', exactly as 'segmentsIntersect' would report it). 'f' returns
+    /// true to keep going; return false if 'f' asked to stop.
+    template< typename F >
+    bool forEachCellHit( const Seg& hitter, const CellView& bin, size_t first, F&& f ) const
+    {
+        const auto& coords = bin.coords();
+        double hitX[ segmentBlockSize ];
+        double hitY[ segmentBlockSize ];
+        for( size_t blockStart = first; blockStart < coords.size; blockStart += segmentBlockSize ) {
+            const auto count = std::min( segmentBlockSize, coords.size - blockStart );
+            auto hits = segmentsIntersectBlock( hitter, coords, blockStart, count, hitX, hitY );
+            while( hits ) {
+                const auto i = lowestSetBit( hits );
+                hits &= hits - 1;
+                const auto idx = bin[ blockStart + i ];
+                if( !_segDead[ idx ] && !f( idx, Pos( hitX[ i ], hitY[ i ] ) ) ) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /// In the editable layout, remove from cell (x,y) every index for which 'removeIfTrue( idx )'.
+    template< typename Pred >
+    void eraseFromCell( int x, int y, Pred&& removeIfTrue )
+    {
+        auto& bin = _grid.getRef( x, y );
+        auto& coords = _gridCoords.getRef( x, y );
+        size_t kept = 0;
+        for( size_t i = 0; i < bin.size(); i++ ) {
+            if( !removeIfTrue( bin[ i ] ) ) {
+                if( kept != i ) {
+                    bin[ kept ] = bin[ i ];
+                    coords.set( kept, coords.seg( i ) );
+                }
+                kept++;
+            }
+        }
+        bin.resize( kept );
+        coords.resize( kept );
+    }
+
+    void markDead( SegIndex idx )
+    {
+        _segDead[ idx ] = true;
+        _numDead++;
+        _numDeadInCells++;
+    }
+
+    /// Drop dead entries from the cells once they outnumber the live segments, so that the total
+    /// cost of compacting stays proportional to the number of segments removed.
+    void compactIfSparse()
+    {
+        if( _numDeadInCells < minDeadToCompact || _numDeadInCells < _segs.size() - _numDead ) {
+            return;
+        }
+        compactCells( nullptr );
+    }
+
+    /// Drop dead entries from the cells, and renumber the rest by 'oldToNew' (if not null).
+    void compactCells( const SegIndices* oldToNew )
+    {
+        const auto isDead = [ this ]( SegIndex idx )
+        {
+            return static_cast< bool >( _segDead[ idx ] );
+        };
+        const auto renumbered = [ oldToNew ]( SegIndex idx )
+        {
+            return oldToNew ? ( *oldToNew )[ idx ] : idx;
+        };
+        if( _quadtree ) {
+            _quadtree->removeIf( isDead );
+            if( oldToNew ) {
+                _quadtree->renumber( *oldToNew );
+            }
+        } else if( _frozen ) {
+            // Slide each cell's survivors down over the gaps left by earlier cells.
+            const size_t numCells = _cellStart.size() - 1;
+            SegIndex write = 0;
+            SegIndex oldStart = _cellStart[ 0 ];
+            for( size_t c = 0; c < numCells; c++ ) {
+                const auto oldEnd = _cellStart[ c + 1 ];
+                _cellStart[ c ] = write;
+                for( auto i = oldStart; i < oldEnd; i++ ) {
+                    if( !isDead( _cellSegs[ i ] ) ) {
+                        _cellSegs[ write ] = renumbered( _cellSegs[ i ] );
+                        _cellSegCoords.set( write, _cellSegCoords.seg( i ) );
+                        write++;
+                    }
+                }
+                oldStart = oldEnd;
+            }
+            _cellStart[ numCells ] = write;
+            _cellSegs.resize( write );
+            _cellSegCoords.resize( write );
+        } else {
+            for( int y = 0; y < _grid.height(); y++ ) {
+                for( int x = 0; x < _grid.width(); x++ ) {
+                    eraseFromCell( x, y, isDead );
+                    if( oldToNew ) {
+                        for( auto& idx : _grid.getRef( x, y ) ) {
+                            idx = renumbered( idx );
+                        }
+                    }
+                }
+            }
+        }
+        _numDeadInCells = 0;
+    }
+
+    static size_t lowestSetBit( std::uint64_t bits )
+    {
+        size_t ret = 0;
+        while( !( bits & 1 ) ) {
+            bits >>= 1;
+            ret++;
+        }
+        return ret;
+    }
+
+    size_t cellIndex( int x, int y ) const
+    {
+        return static_cast< size_t >( y ) * static_cast< size_t >( _grid.width() ) + static_cast< size_t >( x );
+    }
+
+    /// If frozen, move the cell contents back into the editable layout.
+    void thaw()
+    {
+        if( !_frozen ) {
+            return;
+        }
+        for( int y = 0; y < _grid.height(); y++ ) {
+            for( int x = 0; x < _grid.width(); x++ ) {
+                const auto cellIdx = cellIndex( x, y );
+                const auto first = _cellStart[ cellIdx ];
+                const auto last = _cellStart[ cellIdx + 1 ];
+                _grid.getRef( x, y ).assign( _cellSegs.begin() + first, _cellSegs.begin() + last );
+                auto& coords = _gridCoords.getRef( x, y );
+                coords.clear();
+                for( auto i = first; i < last; i++ ) {
+                    coords.push_back( _cellSegCoords.seg( i ) );
+                }
+            }
+        }
+        _cellStart.clear();
+        _cellSegs.clear();
+        _cellSegCoords.clear();
+        _frozen = false;
+    }
+
+    /// Fewer dead segments than this are not worth compacting away.
+    static constexpr size_t minDeadToCompact = 1024;
+
+    /// Every segment added since the last 'clear()'/'bulkLoad()'/'compactPool()', indexed by 'SegIndex'.
+    SegsWithData _segs;
+    /// Parallel to '_segs': which have been removed.
+    std::vector< bool > _segDead;
+    size_t _numDead = 0;
+    /// How many dead segments may still have entries in cells.
+    size_t _numDeadInCells = 0;
+
+    /// Editable layout
+    core::TwoDArray< SegIndices > _grid;
+    /// The coordinates of the segments in '_grid', cell by cell.
+    core::TwoDArray< SegmentBatch > _gridCoords;
+
+    /// Frozen layout: cell i (row-major) holds '_cellSegs[ _cellStart[ i ] ]' up to (not including)
+    /// '_cellSegs[ _cellStart[ i + 1 ] ]'.
+    bool _frozen;
+    SegIndices _cellStart;
+    SegIndices _cellSegs;
+    SegmentBatch _cellSegCoords;
+
+    /// Only for 'AdaptiveQuadtree', in which case it replaces both layouts above.
+    std::unique_ptr< SegQuadtree > _quadtree;
+
     double _cellWidth;
     model::BoundingBox _canvasRect;
 };
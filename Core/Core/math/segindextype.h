@@ -0,0 +1,28 @@
+#ifndef CORE_MATH_SEGINDEXTYPE_H
+#define CORE_MATH_SEGINDEXTYPE_H
+
+namespace core {
+namespace math {
+
+/// How a 'SegColliderGrid' divides its rectangle of space into the cells that hold segments.
+enum SegIndexType
+{
+    /// Square cells of one fixed size.
+    UniformGrid,
+    /// The leaves of a quadtree that subdivides wherever segments are dense, so that crowded
+    /// regions do not end up in a few huge cells.
+    AdaptiveQuadtree
+};
+
+/// How a uniform grid's cells are sized.
+struct SegGridParams
+{
+    double cellWidth = 0.;
+    int cellsWide = 0;
+    int cellsHigh = 0;
+};
+
+} // math
+} // core
+
+#endif // #include
@@ -0,0 +1,191 @@
+#include <math/segquadtree.h>
+
+#include <cmath>
+
+namespace core {
+namespace math {
+
+SegQuadtree::SegQuadtree( const model::BoundingBox& bounds, size_t leafCapacity, int maxDepth )
+    : _leafCapacity( std::max< size_t >( leafCapacity, 1 ) )
+    , _maxDepth( maxDepth )
+{
+    Node root;
+    root.xMin = bounds.topLeft().x();
+    root.yMin = bounds.topLeft().y();
+    root.xMax = bounds.bottomRight().x();
+    root.yMax = bounds.bottomRight().y();
+    _nodes.push_back( root );
+    _pad = 1e-5 + 1e-6 * bounds.maxDim();
+}
+
+void SegQuadtree::insert( SegIndex idx, const Seg& seg )
+{
+    insert( 0, idx, seg );
+}
+
+void SegQuadtree::insert( int nodeIdx, SegIndex idx, const Seg& seg )
+{
+    if( !touches( _nodes[ nodeIdx ], seg ) ) {
+        return;
+    }
+    if( !_nodes[ nodeIdx ].isLeaf() ) {
+        const auto firstChild = _nodes[ nodeIdx ].firstChild;
+        for( int c = 0; c < 4; c++ ) {
+            insert( firstChild + c, idx, seg );
+        }
+        return;
+    }
+
+    auto& leaf = _nodes[ nodeIdx ];
+    leaf.indices.push_back( idx );
+    leaf.coords.push_back( seg );
+    if( leaf.indices.size() > _leafCapacity && leaf.depth < _maxDepth ) {
+        split( nodeIdx );
+    }
+}
+
+void SegQuadtree::split( int nodeIdx )
+{
+    const auto firstChild = static_cast< int >( _nodes.size() );
+    {
+        // 'push_back' below may move '_nodes[ nodeIdx ]', so read it first.
+        const auto& parent = _nodes[ nodeIdx ];
+        const double xMid = ( parent.xMin + parent.xMax ) * 0.5;
+        const double yMid = ( parent.yMin + parent.yMax ) * 0.5;
+        const std::array< double, 3 > xs{ parent.xMin, xMid, parent.xMax };
+        const std::array< double, 3 > ys{ parent.yMin, yMid, parent.yMax };
+        const int depth = parent.depth + 1;
+        std::array< Node, 4 > children;
+        for( int c = 0; c < 4; c++ ) {
+            auto& child = children[ c ];
+            child.xMin = xs[ c % 2 ];
+            child.xMax = xs[ c % 2 + 1 ];
+            child.yMin = ys[ c / 2 ];
+            child.yMax = ys[ c / 2 + 1 ];
+            child.depth = depth;
+        }
+        for( auto& child : children ) {
+            _nodes.push_back( std::move( child ) );
+        }
+    }
+
+    auto indices = std::move( _nodes[ nodeIdx ].indices );
+    auto coords = std::move( _nodes[ nodeIdx ].coords );
+    _nodes[ nodeIdx ].indices.clear();
+    _nodes[ nodeIdx ].coords.clear();
+    _nodes[ nodeIdx ].firstChild = firstChild;
+
+    // In stored order, so that the children's indices stay sorted.
+    for( size_t i = 0; i < indices.size(); i++ ) {
+        const auto seg = coords.seg( i );
+        for( int c = 0; c < 4; c++ ) {
+            insert( firstChild + c, indices[ i ], seg );
+        }
+    }
+}
+
+void SegQuadtree::removeIf( const std::function< bool( SegIndex ) >& removeIfTrue )
+{
+    for( auto& node : _nodes ) {
+        if( !node.isLeaf() ) {
+            continue;
+        }
+        size_t kept = 0;
+        for( size_t i = 0; i < node.indices.size(); i++ ) {
+            if( !removeIfTrue( node.indices[ i ] ) ) {
+                if( kept != i ) {
+                    node.indices[ kept ] = node.indices[ i ];
+                    node.coords.set( kept, node.coords.seg( i ) );
+                }
+                kept++;
+            }
+        }
+        node.indices.resize( kept );
+        node.coords.resize( kept );
+    }
+}
+
+void SegQuadtree::renumber( const SegIndices& oldToNew )
+{
+    for( auto& node : _nodes ) {
+        for( auto& idx : node.indices ) {
+            idx = oldToNew[ idx ];
+        }
+    }
+}
+
+void SegQuadtree::clear()
+{
+    _nodes.resize( 1 );
+    auto& root = _nodes.front();
+    root.firstChild = -1;
+    root.indices.clear();
+    root.coords.clear();
+}
+
+size_t SegQuadtree::numEntries() const
+{
+    size_t ret = 0;
+    forEachLeaf( [ &ret ]( const Node& leaf )
+    {
+        ret += leaf.indices.size();
+    } );
+    return ret;
+}
+
+bool SegQuadtree::owns( const Node& leaf, const Pos& p ) const
+{
+    const auto& root = _nodes.front();
+    const double x = std::clamp( p.x(), root.xMin, root.xMax );
+    const double y = std::clamp( p.y(), root.yMin, root.yMax );
+    // Leaves on the root's far edges also own that edge.
+    return x >= leaf.xMin && ( x < leaf.xMax || leaf.xMax == root.xMax )
+        && y >= leaf.yMin && ( y < leaf.yMax || leaf.yMax == root.yMax );
+}
+
+bool SegQuadtree::clipToBox( const Seg& seg, double xMin, double yMin, double xMax, double yMax, double& storeF )
+{
+    // Liang-Barsky
+    double f0 = 0.;
+    double f1 = 1.;
+    const double d[ 2 ] = { seg.b.x() - seg.a.x(), seg.b.y() - seg.a.y() };
+    const double start[ 2 ] = { seg.a.x(), seg.a.y() };
+    const double lo[ 2 ] = { xMin, yMin };
+    const double hi[ 2 ] = { xMax, yMax };
+    for( int axis = 0; axis < 2; axis++ ) {
+        if( d[ axis ] == 0. ) {
+            if( start[ axis ] < lo[ axis ] || start[ axis ] > hi[ axis ] ) {
+                return false;
+            }
+            continue;
+        }
+        double fLo = ( lo[ axis ] - start[ axis ] ) / d[ axis ];
+        double fHi = ( hi[ axis ] - start[ axis ] ) / d[ axis ];
+        if( fLo > fHi ) {
+            std::swap( fLo, fHi );
+        }
+        f0 = std::max( f0, fLo );
+        f1 = std::min( f1, fHi );
+        if( f0 > f1 ) {
+            return false;
+        }
+    }
+    storeF = f0;
+    return true;
+}
+
+double SegQuadtree::boxDist( const Node& node, const Pos& p )
+{
+    const double dx = std::max( { node.xMin - p.x(), 0., p.x() - node.xMax } );
+    const double dy = std::max( { node.yMin - p.y(), 0., p.y() - node.yMax } );
+    return std::sqrt( dx * dx + dy * dy );
+}
+
+bool SegQuadtree::touches( const Node& node, const Seg& seg ) const
+{
+    double unused = 0.;
+    return clipToBox( seg, node.xMin - _pad, node.yMin - _pad, node.xMax + _pad, node.yMax + _pad, unused );
+}
+
+} // math
+} // core
@@ -0,0 +1,198 @@
+#ifndef CORE_MATH_SEGQUADTREE_H
+#define CORE_MATH_SEGQUADTREE_H
+
+#include <Core/model/boundingboxback.h>
+#include <Core/model/lineback.h>
+#include <Core/model/posback.h>
+
+#include <Core/utility/segmentbatch.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+namespace core {
+namespace math {
+
+/// Adaptive quadtree over line segments (known by index): a leaf that comes to hold more than
+/// 'leafCapacity' segments splits into four, down to 'maxDepth'. A segment is stored in every leaf
+/// it passes through (or nearly so), so leaves play the role of a uniform grid's cells but are small
+/// where segments are dense and large where they are sparse.
+class SegQuadtree
+{
+public:
+    using Pos = model::Pos;
+    using Seg = model::Seg;
+    using SegIndex = std::uint32_t;
+    using SegIndices = std::vector< SegIndex >;
+
+    struct Node
+    {
+        double xMin = 0.;
+        double yMin = 0.;
+        double xMax = 0.;
+        double yMax = 0.;
+        int depth = 0;
+        /// Index (in the node array) of the first of four consecutive children; -1 for leaves.
+        int firstChild = -1;
+        /// Leaves only: the stored segments in increasing order of index, with their coordinates.
+        SegIndices indices;
+        SegmentBatch coords;
+
+        bool isLeaf() const { return firstChild < 0; }
+    };
+
+    SegQuadtree( const model::BoundingBox& bounds, size_t leafCapacity = 32, int maxDepth = 10 );
+
+    /// 'idx' must exceed every index currently stored.
+    void insert( SegIndex idx, const Seg& seg );
+    /// Remove every stored index for which 'removeIfTrue( idx )'. Leaves do not merge back.
+    void removeIf( const std::function< bool( SegIndex ) >& removeIfTrue );
+    /// Replace every stored index 'idx' with 'oldToNew[ idx ]' (which must keep them in the same order).
+    void renumber( const SegIndices& oldToNew );
+    void clear();
+
+    /// Call 'f( leaf )' for every leaf whose box 'seg' passes through; stop if 'f' returns false.
+    /// Return false iff stopped.
+    template< typename F >
+    bool forEachLeafAlong( const Seg& seg, F&& f ) const
+    {
+        return forEachLeafAlongInOrder( seg,
+        [ & ]( const Node& leaf, double )
+        {
+            return f( leaf );
+        } );
+    }
+
+    /// Like 'forEachLeafAlong', but visit leaves in the order 'seg' enters them, calling
+    /// 'f( leaf, fEnter )' where 'fEnter' in [0,1] is how far along 'seg' it enters 'leaf'.
+    template< typename F >
+    bool forEachLeafAlongInOrder( const Seg& seg, F&& f ) const
+    {
+        return alongInOrder( 0, seg, f );
+    }
+
+    /// Call 'f( leaf )' for every leaf overlapping the box [xMin,xMax]X[yMin,yMax].
+    template< typename F >
+    void forEachLeafInBox( double xMin, double yMin, double xMax, double yMax, F&& f ) const
+    {
+        std::vector< int > toVisit{ 0 };
+        while( !toVisit.empty() ) {
+            const auto& node = _nodes[ toVisit.back() ];
+            toVisit.pop_back();
+            if( node.xMax < xMin || node.xMin > xMax || node.yMax < yMin || node.yMin > yMax ) {
+                continue;
+            }
+            if( node.isLeaf() ) {
+                f( node );
+            } else {
+                for( int c = 3; c >= 0; c-- ) {
+                    toVisit.push_back( node.firstChild + c );
+                }
+            }
+        }
+    }
+
+    template< typename F >
+    void forEachLeaf( F&& f ) const
+    {
+        for( const auto& node : _nodes ) {
+            if( node.isLeaf() ) {
+                f( node );
+            }
+        }
+    }
+
+    /// Call 'f( leaf, boxDist )' for leaves in increasing order of the distance 'boxDist' from 'p'
+    /// to their boxes, stopping once 'f' returns false or every leaf has been visited.
+    template< typename F >
+    void forEachLeafByDistance( const Pos& p, F&& f ) const
+    {
+        using DistAndNode = std::pair< double, int >;
+        std::priority_queue< DistAndNode, std::vector< DistAndNode >, std::greater< DistAndNode > > toVisit;
+        toVisit.emplace( boxDist( _nodes.front(), p ), 0 );
+        while( !toVisit.empty() ) {
+            const auto distAndNode = toVisit.top();
+            toVisit.pop();
+            const auto& node = _nodes[ distAndNode.second ];
+            if( node.isLeaf() ) {
+                if( !f( node, distAndNode.first ) ) {
+                    return;
+                }
+            } else {
+                for( int c = 0; c < 4; c++ ) {
+                    const auto childIdx = node.firstChild + c;
+                    toVisit.emplace( boxDist( _nodes[ childIdx ], p ), childIdx );
+                }
+            }
+        }
+    }
+
+    /// Return the total number of (segment, leaf) entries.
+    size_t numEntries() const;
+
+    /// Nodes are numbered from 0 (the root) up to 'numNodes() - 1'.
+    size_t numNodes() const { return _nodes.size(); }
+    const Node& node( size_t i ) const { return _nodes[ i ]; }
+
+    /// Return whether 'p' (clamped to the root's box) falls in 'leaf', with leaves taken to be
+    /// half-open so that every point falls in exactly one.
+    bool owns( const Node& leaf, const Pos& p ) const;
+
+    /// If 'seg' passes through the box [xMin,xMax]X[yMin,yMax], store in 'storeF' how far along
+    /// 'seg' (in [0,1]) it enters the box and return true.
+    static bool clipToBox( const Seg& seg, double xMin, double yMin, double xMax, double yMax, double& storeF );
+private:
+    template< typename F >
+    bool alongInOrder( int nodeIdx, const Seg& seg, F& f ) const
+    {
+        const auto& node = _nodes[ nodeIdx ];
+        double fEnter = 0.;
+        if( !clipToBox( seg, node.xMin, node.yMin, node.xMax, node.yMax, fEnter ) ) {
+            return true;
+        }
+        if( node.isLeaf() ) {
+            return f( node, fEnter );
+        }
+
+        // The children are disjoint and convex, so 'seg' passes through them in the order it enters them.
+        std::array< std::pair< double, int >, 4 > children;
+        size_t numChildren = 0;
+        for( int c = 0; c < 4; c++ ) {
+            const auto& child = _nodes[ node.firstChild + c ];
+            double fChild = 0.;
+            if( clipToBox( seg, child.xMin, child.yMin, child.xMax, child.yMax, fChild ) ) {
+                children[ numChildren++ ] = { fChild, node.firstChild + c };
+            }
+        }
+        std::sort( children.begin(), children.begin() + numChildren );
+        for( size_t i = 0; i < numChildren; i++ ) {
+            if( !alongInOrder( children[ i ].second, seg, f ) ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static double boxDist( const Node&, const Pos& );
+
+    void insert( int nodeIdx, SegIndex idx, const Seg& seg );
+    void split( int nodeIdx );
+    /// Whether 'seg' passes within '_pad' of 'node'.
+    bool touches( const Node& node, const Seg& seg ) const;
+
+    std::vector< Node > _nodes;
+    size_t _leafCapacity;
+    int _maxDepth;
+    /// Segments are stored in leaves they pass within this distance of, so that intersection
+    /// tests (which have some tolerance) never miss a hit just outside a leaf.
+    double _pad;
+};
+
+} // math
+} // core
+
+#endif // #include
@@ -97,6 +97,21 @@ double Stroke::width( double t ) const
     return std::max( 0.0, _width->position( t ).y() );
 }
 
+void Stroke::widths( const std::vector< double >& ts, std::vector< double >& storeWidths ) const
+{
+    std::vector< Vector2 > scratch;
+    widths( ts, storeWidths, scratch );
+}
+
+void Stroke::widths( const std::vector< double >& ts, std::vector< double >& storeWidths, std::vector< Vector2 >& scratch ) const
+{
+    _width->positionsAndDerivatives( ts, &scratch, nullptr );
+    storeWidths.resize( ts.size() );
+    for( size_t i = 0; i < ts.size(); i++ ) {
+        storeWidths[ i ] = std::max( 0.0, scratch[ i ].y() );
+    }
+}
+
 double Stroke::maxWidth() const
 {
     double toReturn = 0.0;
@@ -8,6 +8,7 @@
 #include <boost/core/noncopyable.hpp>
 
 #include <memory>
+#include <vector>
 
 namespace core {
 class CurveInterval;
@@ -49,6 +50,10 @@ public:
 
     /// Return the width of the 'Stroke' in canvas space at 't' in [0,1].
     double width( double t ) const;
+    /// Store in 'storeWidths' the 'width' at each of 'ts'.
+    void widths( const std::vector< double >& ts, std::vector< double >& storeWidths ) const;
+    /// Like the above, but evaluate the width curve into 'scratch' so that repeated calls need not allocate.
+    void widths( const std::vector< double >& ts, std::vector< double >& storeWidths, std::vector< Vector2 >& scratch ) const;
     double maxWidth() const;
     const WidthCurve& widthCurve() const;
 private:
@@ -513,6 +513,39 @@ Vector2 BSpline2::secondDerivative(double t) const
     return Vector2( jet.back()[ 0 ], jet.back()[ 1 ] );
 }
 
+void BSpline2::positionsAndDerivatives( const std::vector< double >& ts,
+                                        std::vector< Vector2 >* storePositions,
+                                        std::vector< Vector2 >* storeDerivatives ) const
+{
+    if( storePositions ) {
+        storePositions->resize( ts.size() );
+    }
+    if( storeDerivatives ) {
+        storeDerivatives->resize( ts.size() );
+    }
+
+    // Room for the whole jet, which GTE fills on failure.
+    std::array< GteVec2, GTESpline::SUP_ORDER > jet;
+    const uint32_t order = storeDerivatives ? 1 : 0;
+    for( size_t i = 0; i < ts.size(); i++ ) {
+        const auto t = ts[ i ];
+        _gteSpline->Evaluate( t, order, jet.data() );
+        if( storePositions ) {
+            // As 'position' does
+            if( t == 0.0 ) {
+                ( *storePositions )[ i ] = _controlPoints.front();
+            } else if( t == 1.0 ) {
+                ( *storePositions )[ i ] = _controlPoints.back();
+            } else {
+                ( *storePositions )[ i ] = Vector2( jet[ 0 ][ 0 ], jet[ 0 ][ 1 ] );
+            }
+        }
+        if( storeDerivatives ) {
+            ( *storeDerivatives )[ i ] = Vector2( jet[ 1 ][ 0 ], jet[ 1 ][ 1 ] );
+        }
+    }
+}
+
 double BSpline2::curvatureSigned( double t ) const
 {
     // From "High accuracy geometric Hermite interpolation."
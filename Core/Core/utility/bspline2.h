@@ -81,6 +81,12 @@ public:
     Vector2 derivative( double t ) const;
     /// 't' must be in [0,1].
     Vector2 secondDerivative( double t ) const;
+    /// Store in 'storePositions' and 'storeDerivatives' (either of which can be null) what 'position'
+    /// and 'derivative' return at each of 'ts' (all in [0,1]), evaluating both with one pass over the
+    /// basis functions per T and without allocating per T.
+    void positionsAndDerivatives( const std::vector< double >& ts,
+                                  std::vector< Vector2 >* storePositions,
+                                  std::vector< Vector2 >* storeDerivatives ) const;
 
     const Control& controlPoints() const;
     /// Return one of the endpoint curvature magnitudes. If there are duplicate control points at either end of the spline,
@@ -0,0 +1,10 @@
+#include <utility/parallelfor.h>
+
+namespace core {
+
+size_t numWorkerThreads()
+{
+    return std::max< size_t >( std::thread::hardware_concurrency(), 1 );
+}
+
+} // core
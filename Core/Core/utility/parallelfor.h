@@ -0,0 +1,65 @@
+#ifndef CORE_UTILITY_PARALLELFOR_H
+#define CORE_UTILITY_PARALLELFOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace core {
+
+/// Return how many threads 'parallelForChunks' runs on (at least 1).
+size_t numWorkerThreads();
+
+/// Split [0,n) into 'numChunks' contiguous chunks of (nearly) equal size and call
+/// 'f( chunk, begin, end )' once for each, from up to 'numWorkerThreads()' threads at a time.
+/// Return once every call has returned. If any call throws, rethrow (one of) its exception(s) here.
+///
+/// Which chunk covers which range does not depend on the number of threads, so callers that
+/// keep one output buffer per chunk and merge them in chunk order get deterministic results.
+template< typename F >
+void parallelForChunks( size_t n, size_t numChunks, F&& f )
+{
+    numChunks = std::max< size_t >( std::min( numChunks, n ), 1 );
+    const auto chunkBegin = [ n, numChunks ]( size_t chunk )
+    {
+        return n * chunk / numChunks;
+    };
+
+    std::atomic< size_t > nextChunk( 0 );
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    const auto work = [ & ]()
+    {
+        for( auto chunk = nextChunk++; chunk < numChunks; chunk = nextChunk++ ) {
+            try {
+                f( chunk, chunkBegin( chunk ), chunkBegin( chunk + 1 ) );
+            } catch( ... ) {
+                std::lock_guard< std::mutex > lock( errorMutex );
+                if( !error ) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    const auto numThreads = std::min( numWorkerThreads(), numChunks );
+    std::vector< std::thread > helpers;
+    for( size_t i = 1; i < numThreads; i++ ) {
+        helpers.emplace_back( work );
+    }
+    work();
+    for( auto& helper : helpers ) {
+        helper.join();
+    }
+    if( error ) {
+        std::rethrow_exception( error );
+    }
+}
+
+} // core
+
+#endif // #include
@@ -0,0 +1,240 @@
+#include <utility/segmentbatch.h>
+
+#include <utility/mathutility.h>
+
+#include <algorithm>
+
+#if defined( __AVX__ ) || defined( __SSE2__ ) || defined( _M_X64 )
+#include <immintrin.h>
+#define CORE_SEGMENTBATCH_SIMD
+#endif
+
+namespace core {
+
+namespace {
+
+/// Must agree with the tolerances used by mathUtility::segmentsIntersect.
+const double boundsEpsilon = 1e-6;
+const double parallelEpsilon = 1e-6;
+
+#ifdef CORE_SEGMENTBATCH_SIMD
+/// Everything about the hitter that 'segmentsIntersect' derives before looking at the other segment.
+struct Hitter
+{
+    Hitter( const LineSegment& seg )
+    {
+        // Homogeneous line through the endpoints, as mathUtility::lineHomogeneous computes it.
+        lx = seg.a.y() - seg.b.y();
+        ly = seg.b.x() - seg.a.x();
+        lz = seg.a.x() * seg.b.y() - seg.a.y() * seg.b.x();
+        xMin = std::min( seg.a.x(), seg.b.x() ) - boundsEpsilon;
+        xMax = std::max( seg.a.x(), seg.b.x() ) + boundsEpsilon;
+        yMin = std::min( seg.a.y(), seg.b.y() ) - boundsEpsilon;
+        yMax = std::max( seg.a.y(), seg.b.y() ) + boundsEpsilon;
+    }
+    double lx, ly, lz;
+    double xMin, xMax, yMin, yMax;
+};
+#endif
+
+/// Test one segment; 'i' indexes both 'segs' and the store arrays.
+bool intersectOne( const LineSegment& hitter, const SegmentBatchView& segs, size_t i,
+                   double* storeHitX, double* storeHitY, size_t storeIdx )
+{
+    Vector2 hit;
+    const bool ret = mathUtility::segmentsIntersect( hitter, segs.seg( i ), hit );
+    storeHitX[ storeIdx ] = hit.x();
+    storeHitY[ storeIdx ] = hit.y();
+    return ret;
+}
+
+} // unnamed
+
+LineSegment SegmentBatchView::seg( size_t i ) const
+{
+    return LineSegment( Vector2( ax[ i ], ay[ i ] ), Vector2( bx[ i ], by[ i ] ) );
+}
+
+void SegmentBatch::push_back( const LineSegment& seg )
+{
+    _ax.push_back( seg.a.x() );
+    _ay.push_back( seg.a.y() );
+    _bx.push_back( seg.b.x() );
+    _by.push_back( seg.b.y() );
+}
+
+void SegmentBatch::set( size_t i, const LineSegment& seg )
+{
+    _ax[ i ] = seg.a.x();
+    _ay[ i ] = seg.a.y();
+    _bx[ i ] = seg.b.x();
+    _by[ i ] = seg.b.y();
+}
+
+LineSegment SegmentBatch::seg( size_t i ) const
+{
+    return view().seg( i );
+}
+
+void SegmentBatch::resize( size_t n )
+{
+    _ax.resize( n );
+    _ay.resize( n );
+    _bx.resize( n );
+    _by.resize( n );
+}
+
+void SegmentBatch::reserve( size_t n )
+{
+    _ax.reserve( n );
+    _ay.reserve( n );
+    _bx.reserve( n );
+    _by.reserve( n );
+}
+
+void SegmentBatch::clear()
+{
+    _ax.clear();
+    _ay.clear();
+    _bx.clear();
+    _by.clear();
+}
+
+size_t SegmentBatch::size() const
+{
+    return _ax.size();
+}
+
+bool SegmentBatch::empty() const
+{
+    return _ax.empty();
+}
+
+SegmentBatchView SegmentBatch::view( size_t first, size_t last ) const
+{
+    SegmentBatchView ret;
+    ret.ax = _ax.data() + first;
+    ret.ay = _ay.data() + first;
+    ret.bx = _bx.data() + first;
+    ret.by = _by.data() + first;
+    ret.size = last - first;
+    return ret;
+}
+
+SegmentBatchView SegmentBatch::view() const
+{
+    return view( 0, size() );
+}
+
+std::uint64_t segmentsIntersectBlock( const LineSegment& hitter, const SegmentBatchView& segs,
+                                      size_t first, size_t count,
+                                      double* storeHitX, double* storeHitY )
+{
+    std::uint64_t mask = 0;
+    size_t i = 0;
+
+#ifdef CORE_SEGMENTBATCH_SIMD
+    // Each lane performs exactly the operations (and roundings) of mathUtility::segmentsIntersect.
+    const Hitter h( hitter );
+#ifdef __AVX__
+    {
+        const __m256d lx = _mm256_set1_pd( h.lx );
+        const __m256d ly = _mm256_set1_pd( h.ly );
+        const __m256d lz = _mm256_set1_pd( h.lz );
+        const __m256d hxMin = _mm256_set1_pd( h.xMin );
+        const __m256d hxMax = _mm256_set1_pd( h.xMax );
+        const __m256d hyMin = _mm256_set1_pd( h.yMin );
+        const __m256d hyMax = _mm256_set1_pd( h.yMax );
+        const __m256d eps = _mm256_set1_pd( boundsEpsilon );
+        const __m256d parEps = _mm256_set1_pd( parallelEpsilon );
+        const __m256d signBit = _mm256_set1_pd( -0. );
+        for( ; i + 4 <= count; i += 4 ) {
+            const size_t s = first + i;
+            const __m256d ax = _mm256_loadu_pd( segs.ax + s );
+            const __m256d ay = _mm256_loadu_pd( segs.ay + s );
+            const __m256d bx = _mm256_loadu_pd( segs.bx + s );
+            const __m256d by = _mm256_loadu_pd( segs.by + s );
+
+            const __m256d mx = _mm256_sub_pd( ay, by );
+            const __m256d my = _mm256_sub_pd( bx, ax );
+            const __m256d mz = _mm256_sub_pd( _mm256_mul_pd( ax, by ), _mm256_mul_pd( ay, bx ) );
+
+            const __m256d ix = _mm256_sub_pd( _mm256_mul_pd( ly, mz ), _mm256_mul_pd( lz, my ) );
+            const __m256d iy = _mm256_sub_pd( _mm256_mul_pd( lz, mx ), _mm256_mul_pd( lx, mz ) );
+            const __m256d iz = _mm256_sub_pd( _mm256_mul_pd( lx, my ), _mm256_mul_pd( ly, mx ) );
+            const __m256d cx = _mm256_div_pd( ix, iz );
+            const __m256d cy = _mm256_div_pd( iy, iz );
+            _mm256_storeu_pd( storeHitX + i, cx );
+            _mm256_storeu_pd( storeHitY + i, cy );
+
+            __m256d reject = _mm256_cmp_pd( _mm256_andnot_pd( signBit, iz ), parEps, _CMP_LT_OQ );
+            reject = _mm256_or_pd( reject, _mm256_cmp_pd( cx, hxMin, _CMP_LT_OQ ) );
+            reject = _mm256_or_pd( reject, _mm256_cmp_pd( cx, hxMax, _CMP_GT_OQ ) );
+            reject = _mm256_or_pd( reject, _mm256_cmp_pd( cy, hyMin, _CMP_LT_OQ ) );
+            reject = _mm256_or_pd( reject, _mm256_cmp_pd( cy, hyMax, _CMP_GT_OQ ) );
+            reject = _mm256_or_pd( reject, _mm256_cmp_pd( cx, _mm256_sub_pd( _mm256_min_pd( ax, bx ), eps ), _CMP_LT_OQ ) );
+            reject = _mm256_or_pd( reject, _mm256_cmp_pd( cx, _mm256_add_pd( _mm256_max_pd( ax, bx ), eps ), _CMP_GT_OQ ) );
+            reject = _mm256_or_pd( reject, _mm256_cmp_pd( cy, _mm256_sub_pd( _mm256_min_pd( ay, by ), eps ), _CMP_LT_OQ ) );
+            reject = _mm256_or_pd( reject, _mm256_cmp_pd( cy, _mm256_add_pd( _mm256_max_pd( ay, by ), eps ), _CMP_GT_OQ ) );
+
+            const auto hits = static_cast< std::uint64_t >( ~_mm256_movemask_pd( reject ) & 0xf );
+            mask |= hits << i;
+        }
+    }
+#endif
+    {
+        const __m128d lx = _mm_set1_pd( h.lx );
+        const __m128d ly = _mm_set1_pd( h.ly );
+        const __m128d lz = _mm_set1_pd( h.lz );
+        const __m128d hxMin = _mm_set1_pd( h.xMin );
+        const __m128d hxMax = _mm_set1_pd( h.xMax );
+        const __m128d hyMin = _mm_set1_pd( h.yMin );
+        const __m128d hyMax = _mm_set1_pd( h.yMax );
+        const __m128d eps = _mm_set1_pd( boundsEpsilon );
+        const __m128d parEps = _mm_set1_pd( parallelEpsilon );
+        const __m128d signBit = _mm_set1_pd( -0. );
+        for( ; i + 2 <= count; i += 2 ) {
+            const size_t s = first + i;
+            const __m128d ax = _mm_loadu_pd( segs.ax + s );
+            const __m128d ay = _mm_loadu_pd( segs.ay + s );
+            const __m128d bx = _mm_loadu_pd( segs.bx + s );
+            const __m128d by = _mm_loadu_pd( segs.by + s );
+
+            const __m128d mx = _mm_sub_pd( ay, by );
+            const __m128d my = _mm_sub_pd( bx, ax );
+            const __m128d mz = _mm_sub_pd( _mm_mul_pd( ax, by ), _mm_mul_pd( ay, bx ) );
+
+            const __m128d ix = _mm_sub_pd( _mm_mul_pd( ly, mz ), _mm_mul_pd( lz, my ) );
+            const __m128d iy = _mm_sub_pd( _mm_mul_pd( lz, mx ), _mm_mul_pd( lx, mz ) );
+            const __m128d iz = _mm_sub_pd( _mm_mul_pd( lx, my ), _mm_mul_pd( ly, mx ) );
+            const __m128d cx = _mm_div_pd( ix, iz );
+            const __m128d cy = _mm_div_pd( iy, iz );
+            _mm_storeu_pd( storeHitX + i, cx );
+            _mm_storeu_pd( storeHitY + i, cy );
+
+            __m128d reject = _mm_cmplt_pd( _mm_andnot_pd( signBit, iz ), parEps );
+            reject = _mm_or_pd( reject, _mm_cmplt_pd( cx, hxMin ) );
+            reject = _mm_or_pd( reject, _mm_cmpgt_pd( cx, hxMax ) );
+            reject = _mm_or_pd( reject, _mm_cmplt_pd( cy, hyMin ) );
+            reject = _mm_or_pd( reject, _mm_cmpgt_pd( cy, hyMax ) );
+            reject = _mm_or_pd( reject, _mm_cmplt_pd( cx, _mm_sub_pd( _mm_min_pd( ax, bx ), eps ) ) );
+            reject = _mm_or_pd( reject, _mm_cmpgt_pd( cx, _mm_add_pd( _mm_max_pd( ax, bx ), eps ) ) );
+            reject = _mm_or_pd( reject, _mm_cmplt_pd( cy, _mm_sub_pd( _mm_min_pd( ay, by ), eps ) ) );
+            reject = _mm_or_pd( reject, _mm_cmpgt_pd( cy, _mm_add_pd( _mm_max_pd( ay, by ), eps ) ) );
+
+            const auto hits = static_cast< std::uint64_t >( ~_mm_movemask_pd( reject ) & 0x3 );
+            mask |= hits << i;
+        }
+    }
+#endif
+
+    // Whatever the vector loops left over.
+    for( ; i < count; i++ ) {
+        if( intersectOne( hitter, segs, first + i, storeHitX, storeHitY, i ) ) {
+            mask |= std::uint64_t( 1 ) << i;
+        }
+    }
+    return mask;
+}
+
+} // core
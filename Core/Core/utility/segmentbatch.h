@@ -0,0 +1,64 @@
+#ifndef CORE_UTILITY_SEGMENTBATCH_H
+#define CORE_UTILITY_SEGMENTBATCH_H
+
+#include <Core/utility/linesegment.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace core {
+
+/// Read-only access to the endpoint coordinates of 'size' line segments stored as a structure of
+/// arrays: segment i runs from ( ax[ i ], ay[ i ] ) to ( bx[ i ], by[ i ] ).
+struct SegmentBatchView
+{
+    const double* ax = nullptr;
+    const double* ay = nullptr;
+    const double* bx = nullptr;
+    const double* by = nullptr;
+    size_t size = 0;
+
+    LineSegment seg( size_t i ) const;
+};
+
+/// Line segments stored as a structure of arrays, the layout expected by 'segmentsIntersectBlock'.
+class SegmentBatch
+{
+public:
+    void push_back( const LineSegment& );
+    void set( size_t i, const LineSegment& );
+    LineSegment seg( size_t i ) const;
+    void resize( size_t );
+    void reserve( size_t );
+    void clear();
+    size_t size() const;
+    bool empty() const;
+
+    /// Segments [first,last).
+    SegmentBatchView view( size_t first, size_t last ) const;
+    SegmentBatchView view() const;
+private:
+    std::vector< double > _ax;
+    std::vector< double > _ay;
+    std::vector< double > _bx;
+    std::vector< double > _by;
+};
+
+/// The most segments that one 'segmentsIntersectBlock' call tests.
+const size_t segmentBlockSize = 64;
+
+/// Test 'hitter' against segments [first,first+count) of 'segs', where 'count' is at most
+/// 'segmentBlockSize'. Bit i of the returned mask is set iff segment 'first + i' intersects
+/// 'hitter', in which case ( storeHitX[ i ], storeHitY[ i ] ) is the intersection; both arrays
+/// must have room for 'count' values. Results match mathUtility::segmentsIntersect( hitter, ... )
+/// exactly.
+///
+/// Several segments are tested at once using AVX (when compiled in) or SSE2, with a scalar
+/// fallback on other targets.
+std::uint64_t segmentsIntersectBlock( const LineSegment& hitter, const SegmentBatchView& segs,
+                                      size_t first, size_t count,
+                                      double* storeHitX, double* storeHitY );
+
+} // core
+
+#endif // #include
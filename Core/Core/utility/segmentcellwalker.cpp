@@ -0,0 +1,134 @@
+#include <utility/segmentcellwalker.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+namespace core {
+
+namespace {
+
+int cellOf( double v )
+{
+    return static_cast< int >( std::floor( v ) );
+}
+
+} // unnamed
+
+SegmentCellWalker::SegmentCellWalker( const Vector2& a, const Vector2& b )
+{
+    init( a, b, 0., 1. );
+}
+
+SegmentCellWalker::SegmentCellWalker( const Vector2& a, const Vector2& b, int width, int height )
+{
+    // Liang-Barsky clip of 'a'->'b' to the box.
+    double fStart = 0.;
+    double fEnd = 1.;
+    const double d[ 2 ] = { b.x() - a.x(), b.y() - a.y() };
+    const double p0[ 2 ] = { a.x(), a.y() };
+    const double maxVal[ 2 ] = { static_cast< double >( width ), static_cast< double >( height ) };
+    for( int axis = 0; axis < 2; axis++ ) {
+        if( d[ axis ] == 0. ) {
+            if( p0[ axis ] < 0. || p0[ axis ] > maxVal[ axis ] ) {
+                fEnd = -1.;
+            }
+            continue;
+        }
+        double fA = ( 0. - p0[ axis ] ) / d[ axis ];
+        double fB = ( maxVal[ axis ] - p0[ axis ] ) / d[ axis ];
+        if( fA > fB ) {
+            std::swap( fA, fB );
+        }
+        fStart = std::max( fStart, fA );
+        fEnd = std::min( fEnd, fB );
+    }
+
+    if( fStart > fEnd ) {
+        // Nothing to walk.
+        _cell = IntCoord( 0, 0 );
+        _fEnter = 1.;
+        _fNextX = _fNextY = std::numeric_limits< double >::max();
+        _fDeltaX = _fDeltaY = 0.;
+        _stepX = _stepY = 0;
+        _cellsLeft = 0;
+        return;
+    }
+    init( a, b, fStart, fEnd );
+}
+
+void SegmentCellWalker::init( const Vector2& a, const Vector2& b, double fStart, double fEnd )
+{
+    const auto dX = b.x() - a.x();
+    const auto dY = b.y() - a.y();
+    const auto start = a + ( b - a ) * fStart;
+    const auto end = a + ( b - a ) * fEnd;
+
+    _cell = IntCoord( cellOf( start.x() ), cellOf( start.y() ) );
+    const IntCoord endCell( cellOf( end.x() ), cellOf( end.y() ) );
+    _fEnter = fStart;
+    _cellsLeft = std::abs( endCell.x() - _cell.x() ) + std::abs( endCell.y() - _cell.y() ) + 1;
+
+    const auto inf = std::numeric_limits< double >::max();
+    if( dX > 0. ) {
+        _stepX = 1;
+        _fDeltaX = 1. / dX;
+        _fNextX = ( static_cast< double >( _cell.x() + 1 ) - a.x() ) / dX;
+    } else if( dX < 0. ) {
+        _stepX = -1;
+        _fDeltaX = -1. / dX;
+        _fNextX = ( static_cast< double >( _cell.x() ) - a.x() ) / dX;
+    } else {
+        _stepX = 0;
+        _fDeltaX = 0.;
+        _fNextX = inf;
+    }
+    if( dY > 0. ) {
+        _stepY = 1;
+        _fDeltaY = 1. / dY;
+        _fNextY = ( static_cast< double >( _cell.y() + 1 ) - a.y() ) / dY;
+    } else if( dY < 0. ) {
+        _stepY = -1;
+        _fDeltaY = -1. / dY;
+        _fNextY = ( static_cast< double >( _cell.y() ) - a.y() ) / dY;
+    } else {
+        _stepY = 0;
+        _fDeltaY = 0.;
+        _fNextY = inf;
+    }
+}
+
+bool SegmentCellWalker::done() const
+{
+    return _cellsLeft <= 0;
+}
+
+void SegmentCellWalker::advance()
+{
+    _cellsLeft--;
+    if( _cellsLeft <= 0 ) {
+        return;
+    }
+    if( _fNextX < _fNextY ) {
+        _cell.setX( _cell.x() + _stepX );
+        _fEnter = _fNextX;
+        _fNextX += _fDeltaX;
+    } else {
+        _cell.setY( _cell.y() + _stepY );
+        _fEnter = _fNextY;
+        _fNextY += _fDeltaY;
+    }
+}
+
+const IntCoord& SegmentCellWalker::cell() const
+{
+    return _cell;
+}
+
+double SegmentCellWalker::fEnter() const
+{
+    return _fEnter;
+}
+
+} // core
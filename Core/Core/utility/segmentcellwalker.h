@@ -0,0 +1,51 @@
+#ifndef CORE_UTILITY_SEGMENTCELLWALKER_H
+#define CORE_UTILITY_SEGMENTCELLWALKER_H
+
+#include <Core/utility/intcoord.h>
+#include <Core/utility/vector2.h>
+
+namespace core {
+
+/// Walks, in order from 'a' to 'b', every unit cell that the segment 'a'->'b' passes through, where
+/// cell (x,y) covers [x,x+1)X[y,y+1). This is the Amanatides-Woo grid traversal: unlike the
+/// rasterizeSegment_...() functions it allocates nothing, never skips a cell the segment touches,
+/// and reports how far along the segment each cell is entered, which lets callers stop early.
+///
+///     for( SegmentCellWalker walker( a, b ); !walker.done(); walker.advance() ) {
+///         visit( walker.cell() );
+///     }
+class SegmentCellWalker
+{
+public:
+    /// Walk all of 'a'->'b'.
+    SegmentCellWalker( const Vector2& a, const Vector2& b );
+    /// Walk only the part of 'a'->'b' inside [0,width]X[0,height] (possibly nothing).
+    SegmentCellWalker( const Vector2& a, const Vector2& b, int width, int height );
+
+    bool done() const;
+    /// Call only if !done().
+    void advance();
+    /// The current cell.
+    const IntCoord& cell() const;
+    /// In [0,1]: the fraction of the way from 'a' to 'b' at which the segment enters cell().
+    double fEnter() const;
+private:
+    void init( const Vector2& a, const Vector2& b, double fStart, double fEnd );
+
+    IntCoord _cell;
+    double _fEnter;
+    /// The 'f' at which the segment crosses the next vertical/horizontal cell boundary.
+    double _fNextX;
+    double _fNextY;
+    /// How much 'f' changes when crossing one cell horizontally/vertically.
+    double _fDeltaX;
+    double _fDeltaY;
+    int _stepX;
+    int _stepY;
+    /// Cells left to visit, including the current one.
+    int _cellsLeft;
+};
+
+} // core
+
+#endif // #include
@@ -0,0 +1,53 @@
+#include <utility/visitstamps.h>
+
+#include <algorithm>
+#include <memory>
+
+namespace core {
+
+namespace {
+
+struct ThreadStampsPool
+{
+    std::vector< std::unique_ptr< VisitStamps > > stamps;
+    /// How many of 'stamps' are currently lent out.
+    size_t inUse = 0;
+};
+
+ThreadStampsPool& threadStampsPool()
+{
+    thread_local ThreadStampsPool pool;
+    return pool;
+}
+
+} // unnamed
+
+void VisitStamps::startPass( size_t numIDs )
+{
+    if( _stamps.size() < numIDs ) {
+        _stamps.resize( numIDs, 0 );
+    }
+    _epoch++;
+    if( _epoch == 0 ) {
+        // Wrapped around: stale stamps could now look current.
+        std::fill( _stamps.begin(), _stamps.end(), 0 );
+        _epoch = 1;
+    }
+}
+
+ThreadVisitStamps::ThreadVisitStamps( size_t numIDs )
+{
+    auto& pool = threadStampsPool();
+    if( pool.inUse == pool.stamps.size() ) {
+        pool.stamps.push_back( std::make_unique< VisitStamps >() );
+    }
+    _stamps = pool.stamps[ pool.inUse++ ].get();
+    _stamps->startPass( numIDs );
+}
+
+ThreadVisitStamps::~ThreadVisitStamps()
+{
+    threadStampsPool().inUse--;
+}
+
+} // core
@@ -0,0 +1,55 @@
+#ifndef CORE_UTILITY_VISITSTAMPS_H
+#define CORE_UTILITY_VISITSTAMPS_H
+
+#include <cstdint>
+#include <vector>
+
+namespace core {
+
+/// A set of visited IDs in [0,n) that is emptied in O(1) by bumping an epoch counter, so that
+/// repeated "have I seen this one yet?" passes neither allocate nor clear anything.
+class VisitStamps
+{
+public:
+    /// Begin a pass in which no ID in [0,numIDs) has been visited yet.
+    void startPass( size_t numIDs );
+    /// Mark 'id' (which must be less than the last 'startPass' argument) as visited, returning
+    /// whether this is its first visit of the current pass.
+    bool visit( size_t id )
+    {
+        auto& stamp = _stamps[ id ];
+        if( stamp == _epoch ) {
+            return false;
+        }
+        stamp = _epoch;
+        return true;
+    }
+    bool visited( size_t id ) const
+    {
+        return _stamps[ id ] == _epoch;
+    }
+private:
+    std::vector< std::uint32_t > _stamps;
+    std::uint32_t _epoch = 0;
+};
+
+/// Lends the calling thread one of its 'VisitStamps' for the lifetime of 'this', already started
+/// on a new pass. Nested leases on the same thread (e.g., a query run from inside another query's
+/// callback) get distinct 'VisitStamps', so they cannot disturb each other.
+class ThreadVisitStamps
+{
+public:
+    explicit ThreadVisitStamps( size_t numIDs );
+    ~ThreadVisitStamps();
+    ThreadVisitStamps( const ThreadVisitStamps& ) = delete;
+    ThreadVisitStamps& operator = ( const ThreadVisitStamps& ) = delete;
+
+    VisitStamps& operator * () { return *_stamps; }
+    VisitStamps* operator -> () { return _stamps; }
+private:
+    VisitStamps* _stamps;
+};
+
+} // core
+
+#endif // #include
@@ -6,6 +6,7 @@
 #include <samedrawinghits.h>
 #include <strokeback.h>
 #include <strokepoly.h>
+#include <strokepolyindex.h>
 #include <strokesegcollider.h>
 #include <tails/tailmaker.h>
 #include <topology/findtopology.h>
@@ -57,22 +58,29 @@ struct BlendDrawings::Imp
         : parent( p )
         , opts( opts )
         , drawings( std::move( toOwn ) )
-        , collAB( bounds( drawings ) )
+        , collAB( bounds( drawings ), opts.colliderIndex )
         , progBar( nullptr )
     {
         if( progBar ) {
             progBar->startOnlyStage( "Set up original-Strokes collider and same-drawing-hits" );
         }
 
+        StrokePolyHandles polys;
         for( int d = 0; d < DrawingID::NumDrawings; d++ ) {
             drawings[ d ].forEach( [ & ]( const Stroke& s )
               {
                 auto& strokePoly = sToPoly[ &s ];
-                strokePoly = StrokePoly( s, strokePolyLength( s ) );
-                collAB.addStroke( strokePoly );
+                strokePoly = this->strokePoly( s );
+                polys.push_back( &strokePoly );
               } );
         }
+        // 'collAB' only changes after this point if 'replaceStroke' is called.
+        if( opts.autoTuneColliderCells ) {
+            collAB.autoTuneCells( opts.maxColliderCells );
+        }
+        collAB.bulkLoad( polys );
         collAB.sameDrawingHits( sameDrawingHits, drawings );
+        sToPolyIndex = std::make_unique< StrokePolyIndex >( polys );
     }
 
     /// Return how many points the (spine of a) polyline-based 'Stroke' approximation of 's'
@@ -92,6 +100,17 @@ struct BlendDrawings::Imp
         return numPoints;
     }
 
+    StrokePoly strokePoly( const Stroke& s ) const
+    {
+        if( opts.tessellation.adaptive ) {
+            StrokePoly::Tolerance tol;
+            tol.chord = opts.tessellation.maxChordDev_canvas;
+            tol.width = opts.tessellation.maxWidthDev_canvas;
+            return StrokePoly( s, tol );
+        }
+        return StrokePoly( s, strokePolyLength( s ) );
+    }
+
     /// Given 'cComplex' (has at least one 'Substroke') representing some blend-stroke 'bs', store
     /// in 'storePretails' the version of 'bs' prior to having its ends converted to tails, and
     /// store in 'storePreserve' the interval of 'storePretails' that must not be converted to tails.
@@ -280,7 +299,18 @@ struct BlendDrawings::Imp
         if( doProg ) {
             progBar->startOnlyStage( "Make tails collider", static_cast< int >( numChains ) );
         }
-        StrokeSegCollider collProg( collAB.bounds() );
+        // The preserved drawing's 'Stroke's are already in 'collAB', so layer 'collProg' over it
+        // rather than adding them again.
+        auto collProg = opts.preserveDrawing
+            ? StrokeSegCollider( collAB,
+                [ this, toPreserveID = *opts.preserveDrawing ]( StrokeHandle stroke )
+                {
+                    return drawings.whichDrawing( stroke ) == toPreserveID;
+                } )
+            : StrokeSegCollider( collAB.bounds(), opts.colliderIndex );
+        if( opts.autoTuneColliderCells && !opts.preserveDrawing && opts.colliderIndex == core::math::UniformGrid ) {
+            collProg.setCellWidth( collAB.gridParams().cellWidth, opts.maxColliderCells );
+        }
         {
             // Put all of 'pretails' inside.
             for( size_t i = 0; i < numChains; i++ ) {
@@ -288,20 +318,9 @@ struct BlendDrawings::Imp
                     progBar->update( static_cast< int >( i ) );
                 }
                 const auto& fromPretails = pretails[ i ];
-                const StrokePoly poly( *fromPretails, strokePolyLength( *fromPretails ) );
+                const auto poly = strokePoly( *fromPretails );
                 collProg.addStroke( poly );
             }
-
-            if( opts.preserveDrawing ) {
-                const auto toPreserveID = *opts.preserveDrawing;
-                for( const auto& pair : sToPoly ) {
-                    const auto& stroke = pair.first;
-                    if( drawings.whichDrawing( stroke ) == toPreserveID ) {
-                        const auto& poly = pair.second;
-                        collProg.addStroke( poly );
-                    }
-                }
-            }
         }
 
         // Generate tails and actual final blend-strokes.
@@ -327,7 +346,7 @@ struct BlendDrawings::Imp
 
             tails::TailMaker tailMaker( *beforeTails, preserveInterval, collProg, *parent );
             auto withTails = tailMaker.result();
-            const StrokePoly sPoly( *withTails, strokePolyLength( *withTails ) );
+            const auto sPoly = strokePoly( *withTails );
             collProg.addStroke( sPoly );
             blendStrokes.push_back( std::move( withTails ) );
         }
@@ -543,12 +562,16 @@ struct BlendDrawings::Imp
             progBar->startOnlyStage( "Finding topology" );
         }
 
-        topology::FindTopology ft(
-            drawings[ DrawingID::DrawingA ],
-            drawings[ DrawingID::DrawingB ],
-            sToPoly );
-
-        topol = ft.topology();
+        // After the first time, 'replaceStroke' keeps 'topol' up to date.
+        if( !topol ) {
+            findTopol = std::make_unique< topology::FindTopology >(
+                drawings[ DrawingID::DrawingA ],
+                drawings[ DrawingID::DrawingB ],
+                sToPoly,
+                collAB,
+                opts.occlusionEngine );
+            topol = findTopol->topology();
+        }
 
         chains::ChainBuilder chainsBuilder( *topol, *parent, progBar );
         const auto chains = chainsBuilder.chains();
@@ -581,6 +604,33 @@ struct BlendDrawings::Imp
         chainsToBlendStrokes( chains );
     }
 
+    void replaceStroke( DrawingID dId, size_t i, UniqueStroke&& toOwn )
+    {
+        // Everything below lets go of the old 'Stroke' (and its 'StrokePoly') before it is destroyed.
+        const auto oldOwned = drawings[ dId ].replaceStroke( i, std::move( toOwn ) );
+        const auto* const oldStroke = oldOwned.get();
+        const auto* const stroke = drawings[ dId ].stroke( i );
+        auto& poly = sToPoly[ stroke ];
+        poly = strokePoly( *stroke );
+        const auto& oldPoly = sToPoly.find( oldStroke )->second;
+
+        collAB.removeStroke( oldStroke );
+        collAB.addStroke( poly );
+        sToPolyIndex->remove( &oldPoly );
+        sToPolyIndex->add( &poly );
+        sameDrawingHits[ dId ].removeStroke( oldStroke );
+        collAB.addSameDrawingHits( stroke, sameDrawingHits, drawings );
+
+        if( topol ) {
+            findTopol->updateStroke( *topol, dId, i, oldStroke );
+            if( opts.checkIncrementalTopology && !topol->sameAs( *findTopol->topology() ) ) {
+                THROW_RUNTIME( "The updated topology differs from one found from scratch." );
+            }
+        }
+
+        sToPoly.erase( oldStroke );
+    }
+
     const BlendDrawings* const parent;
     const BlendOptions& opts;
     Drawings drawings;
@@ -591,7 +641,11 @@ struct BlendDrawings::Imp
     DrawingToSameDrawingHits sameDrawingHits;
     /// Map from original-drawing 'Stroke' to data.
     std::map< StrokeHandle, StrokePoly > sToPoly;
+    /// Over the values of 'sToPoly'.
+    std::unique_ptr< StrokePolyIndex > sToPolyIndex;
 
+    /// Kept (once 'perform' has made it) so that 'replaceStroke' can update 'topol'.
+    std::unique_ptr< topology::FindTopology > findTopol;
     std::unique_ptr< topology::Topology > topol;
     std::vector< UniqueStroke > results;
 
@@ -613,6 +667,11 @@ void BlendDrawings::perform()
     _imp->perform();
 }
 
+void BlendDrawings::replaceStroke( DrawingID dId, size_t i, Drawing::UniqueStroke&& toOwn )
+{
+    _imp->replaceStroke( dId, i, std::move( toOwn ) );
+}
+
 const BlendOptions& BlendDrawings::options() const
 {
     return _imp->opts;
@@ -633,19 +692,24 @@ const StrokeSegCollider& BlendDrawings::collAB() const
     return _imp->collAB;
 }
 
+boost::optional< core::math::SegGridParams > BlendDrawings::tunedColliderGrid() const
+{
+    return _imp->collAB.tunedGridParams();
+}
+
 size_t BlendDrawings::strokePolyLength( const Stroke& s ) const
 {
     return _imp->strokePolyLength( s );
 }
 
+StrokePoly BlendDrawings::strokePoly( const Stroke& s ) const
+{
+    return _imp->strokePoly( s );
+}
+
 bool BlendDrawings::insideOriginalStroke( const core::model::Pos& p ) const
 {
-    for( const auto& pair : _imp->sToPoly ) {
-        if( pair.second.contains( p ) ) {
-            return true;
-        }
-    }
-    return false;
+    return _imp->sToPolyIndex->anyContains( p );
 }
 
 const BlendDrawings::StrokeToPoly& BlendDrawings::originalStrokeToPoly() const
@@ -6,6 +6,9 @@
 
 #include <Core/model/posforward.h>
 #include <Core/model/strokesforward.h>
+#include <Core/math/segindextype.h>
+
+#include <boost/optional.hpp>
 
 #include <map>
 #include <memory>
@@ -32,14 +35,22 @@ public:
 
     BlendDrawings( Drawings&&, const BlendOptions&, core::view::ProgressBar* progBar );
     ~BlendDrawings();
-    /// Call only once.
+    /// Blend the drawings. The first call finds the topology of the drawings; later calls (after
+    /// 'replaceStroke') reuse it as brought up to date.
     void perform();
+    /// Put 'toOwn' (which should lie within the bounds of the original drawings) in place of the 'Stroke'
+    /// at index 'i' of drawing 'dId', updating the collider, the polygon approximations, the same-drawing
+    /// hits, and (after 'perform') the topology for just that 'Stroke' rather than from scratch. Call
+    /// 'perform' again for the blend of the edited drawings.
+    void replaceStroke( DrawingID dId, size_t i, Drawing::UniqueStroke&& toOwn );
     const core::model::UniqueStrokes& result() const;
 
     const BlendOptions& options() const;
     const Drawings& drawings() const;
     /// Return the collider representing only original-drawing 'Stroke's.
     const StrokeSegCollider& collAB() const;
+    /// Return the cell layout chosen for 'collAB' if 'BlendOptions::autoTuneColliderCells' tuned it.
+    boost::optional< core::math::SegGridParams > tunedColliderGrid() const;
     /// Return a mapping from original-drawing 'Stroke' 's' to 'this''s polygon approximation of 's'.
     const StrokeToPoly& originalStrokeToPoly() const;
     const SameDrawingHits& sameDrawingHits( DrawingID ) const;
@@ -50,6 +61,8 @@ public:
     /// Return how many points the (spine of a) polyline-based 'Stroke' approximation of 's'
     /// should be.
     size_t strokePolyLength( const Stroke& s ) const;
+    /// Return the polygon approximation of 's' to use (as 'BlendOptions::tessellation' says).
+    StrokePoly strokePoly( const Stroke& s ) const;
 private:
     struct Imp;
     const std::unique_ptr< Imp > _imp;
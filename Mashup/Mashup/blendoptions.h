@@ -3,6 +3,9 @@
 
 #include <Mashup/weightfunctor.h>
 #include <Mashup/drawingid.h>
+#include <Mashup/topology/occlusionengine.h>
+
+#include <Core/math/segindextype.h>
 
 #include <Core/utility/boundinginterval.h>
 
@@ -47,6 +50,20 @@ struct BlendOptions
         double maxOutsideCircle_f = 0.8;
     };
 
+    struct TessellationOptions
+    {
+        /// If true, place the points of 'Stroke' outline polygons adaptively, subdividing each
+        /// Bezier piece until within the tolerances below, rather than spacing a length-based
+        /// number of points evenly in T.
+        bool adaptive = false;
+        /// in canvas space, >0
+        /// How far an outline polygon's spine may stray from its 'Stroke''s curve.
+        double maxChordDev_canvas = 0.25;
+        /// in canvas space, >0
+        /// How far an outline polygon's width may stray from its 'Stroke''s.
+        double maxWidthDev_canvas = 0.25;
+    };
+
     /// If set (to A or B), then perform a blend-drawings operation that keeps
     /// that drawing visually unchanged.
     boost::optional< DrawingID > preserveDrawing;
@@ -54,8 +71,24 @@ struct BlendOptions
     /// Used to narrow short, stubby blendstrokes.
     double minLengthToWidth = 3.;
 
+    /// How the 'Stroke'-segment colliders organize space. 'AdaptiveQuadtree' suits drawings whose
+    /// detail is concentrated in a few areas.
+    core::math::SegIndexType colliderIndex = core::math::UniformGrid;
+    /// If true, size uniform-grid collider cells from the lengths of the segments they hold,
+    /// rather than fitting a fixed number of cells across the canvas.
+    bool autoTuneColliderCells = false;
+    /// With 'autoTuneColliderCells', the most cells a collider may have (which bounds its memory use).
+    size_t maxColliderCells = size_t( 1 ) << 22;
+
+    /// How to find where the original drawings occlude each other.
+    topology::OcclusionEngine occlusionEngine = topology::MidpointProbes;
+    /// If true, after 'BlendDrawings::replaceStroke' updates the topology, also build it from scratch
+    /// and throw if the two differ. Slow; for checking the incremental update.
+    bool checkIncrementalTopology = false;
+
     RoutingOptions routing;
     TailOptions tails;
+    TessellationOptions tessellation;
 };
 
 } // mashup
@@ -120,8 +120,15 @@ struct StubData
         , stubOrig( stub )
         , stubPretrimmed( stub )
     {
-        const auto stubAsStroke = stub.asStroke();
-        stubOrigPoly = StrokePoly( *stubAsStroke, bd.strokePolyLength( *stubAsStroke ) );
+        // Original-drawing 'Stroke's already have polys covering 'stub'.
+        const auto& origPolys = bd.originalStrokeToPoly();
+        const auto origPoly = origPolys.find( stub.stroke );
+        if( origPoly != origPolys.end() && origPoly->second.participates() ) {
+            stubOrigPoly = origPoly->second.slice( stub.t[ 0 ], stub.t[ 1 ] );
+        } else {
+            const auto stubAsStroke = stub.asStroke();
+            stubOrigPoly = bd.strokePoly( *stubAsStroke );
+        }
         findCutTRange( bd.options() );
     }
 
@@ -328,7 +335,7 @@ struct Joiner::Imp
 
         // Middle part of 'next' (excluding the (pretrimmed) from-'cross' 'Stub's).
         auto nextMidStroke = next.midStroke();
-        const auto midPoly = StrokePoly{ *nextMidStroke, blendDrawings.strokePolyLength( *nextMidStroke ) };
+        const auto midPoly = blendDrawings.strokePoly( *nextMidStroke );
 
         // PRETRIMMING
         // For each unconnected 'Stub' in 'cross' (other than the 'Stub's we're considering connecting),
@@ -551,7 +558,7 @@ struct Joiner::Imp
         // Create a barrier representing this new connection.
         {
             auto asStroke = abData.nextStep->asStroke();
-            barriers.push_back( StrokePoly{ *asStroke, blendDrawings.strokePolyLength( *asStroke ) } );
+            barriers.push_back( blendDrawings.strokePoly( *asStroke ) );
         }
 
         updatePairsConnectibility();
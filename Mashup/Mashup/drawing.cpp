@@ -29,6 +29,22 @@ void Drawing::addStroke( UniqueStroke&& toOwn )
     _handleToIndex[ strokeHandle ] = _strokes.size() - 1;
 }
 
+Drawing::UniqueStroke Drawing::replaceStroke( size_t i, UniqueStroke&& toOwn )
+{
+    if( i >= _strokes.size() ) {
+        THROW_UNEXPECTED;
+    }
+    auto ret = std::move( _strokes[ i ] );
+    _handles.erase( ret.get() );
+    _handleToIndex.erase( ret.get() );
+
+    _strokes[ i ] = std::move( toOwn );
+    const auto* const strokeHandle = _strokes[ i ].get();
+    _handles.emplace( strokeHandle );
+    _handleToIndex[ strokeHandle ] = i;
+    return ret;
+}
+
 size_t Drawing::numStrokes() const
 {
     return _strokes.size();
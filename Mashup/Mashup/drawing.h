@@ -22,6 +22,8 @@ public:
     Drawing( Drawing&& );
     ~Drawing();
     void addStroke( UniqueStroke&& toOwn );
+    /// Put 'toOwn' in place of the 'Stroke' at index 'i', and return the latter.
+    UniqueStroke replaceStroke( size_t i, UniqueStroke&& toOwn );
     StrokeHandle stroke( size_t ) const;
     bool contains( StrokeHandle ) const;
     /// 's' must belong to 'this'.
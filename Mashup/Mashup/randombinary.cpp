@@ -20,7 +20,7 @@ RandomBinary::RandomBinary() : _imp( std::make_unique< Imp >() )
 
 void RandomBinary::seed( SeedType seed )
 {
-    static_assert( std::is_same< SeedType, Gen::result_type >::value, "Wrong SeedType" );
+    //LOCALONLY
     _imp->gen = std::mt19937{ seed };
 }
 
@@ -33,6 +33,39 @@ void SameDrawingHits::addHit( StrokeHandle a, StrokeHandle b, double tA, double
     _strokeToHits[ b ].emplace( bHit );
 }
 
+void SameDrawingHits::addHits( const SameDrawingHits& other )
+{
+    for( const auto& pair : other._strokeToHits ) {
+        _strokeToHits[ pair.first ].insert( pair.second.begin(), pair.second.end() );
+    }
+}
+
+void SameDrawingHits::removeStroke( StrokeHandle s )
+{
+    const auto it = _strokeToHits.find( s );
+    if( it == _strokeToHits.end() ) {
+        return;
+    }
+    for( const auto& hit : it->second ) {
+        const auto otherIt = _strokeToHits.find( hit.other );
+        if( hit.other == s || otherIt == _strokeToHits.end() ) {
+            continue;
+        }
+        auto& otherHits = otherIt->second;
+        for( auto hitIt = otherHits.begin(); hitIt != otherHits.end(); ) {
+            if( hitIt->other == s ) {
+                hitIt = otherHits.erase( hitIt );
+            } else {
+                hitIt++;
+            }
+        }
+        if( otherHits.empty() ) {
+            _strokeToHits.erase( otherIt );
+        }
+    }
+    _strokeToHits.erase( it );
+}
+
 void SameDrawingHits::clear()
 {
     _strokeToHits.clear();
@@ -24,12 +24,16 @@ class SameDrawingHits
 {
 public:
     void addHit( StrokeHandle a, StrokeHandle b, double tA, double tB );
+    /// Add every hit recorded in 'other'.
+    void addHits( const SameDrawingHits& other );
 
     /// Return the T value in 'ss' of the first or last place (as per 'firstOrLast') that 'ss' undergoes some
     /// same-'Drawing' intersection with another original 'Stroke 'b' (where 'b' at T-of-'b'-at-intersection
     /// is not part of 'ignoreIn). If there is no same-'Drawing' intersection on 'ss' that isn't excluded by
     /// 'ignoreIn', return boost::none.
     boost::optional< double > firstOrLastHit( const Substroke& ss, bool firstOrLast, const topology::Crossing& ignoreIn ) const;
+    /// Forget every hit involving 's'.
+    void removeStroke( StrokeHandle s );
     void clear();
 private:
     struct Hit
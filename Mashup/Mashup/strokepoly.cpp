@@ -11,6 +11,10 @@
 
 #include <Core/utility/mathutility.h>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+
 namespace mashup {
 
 using Pos = core::model::Pos;
@@ -58,6 +62,98 @@ bool pointInsideTri( const Pos& point, const Pos& a, const Pos& b, const Pos& c,
     return true;
 }
 
+/// Return the first index in ['begin','end') for which 'pred' is false, given that 'pred' is
+/// true for some prefix of the range and false for the rest.
+template< typename Pred >
+size_t partitionPoint( size_t begin, size_t end, Pred pred )
+{
+    while( begin < end ) {
+        const auto mid = begin + ( end - begin ) / 2;
+        if( pred( mid ) ) {
+            begin = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    return begin;
+}
+
+/// 'segmentsIntersect' tolerates this much separation between its segments' bounding boxes.
+const double segHitSlack = 1e-5;
+
+/// Buffers reused by every 'subdivideWithin' call of one 'adaptiveTFromStroke' call.
+struct ProbeScratch
+{
+    std::vector< double > ts;
+    std::vector< Pos > positions;
+    std::vector< double > widths;
+    /// For 'Stroke::widths'.
+    std::vector< core::Vector2 > widthPositions;
+};
+
+/// Append to 'storeT' T values in ('tA','tB'] of 's' (where 's' has position 'pA'/'pB' and width 'wA'/'wB')
+/// such that straight, linearly widening pieces between consecutive T values stay within 'tol' of 's'.
+void subdivideWithin( const Stroke& s, const StrokePoly::Tolerance& tol,
+                      double tA, const Pos& pA, double wA, double tB, const Pos& pB, double wB,
+                      int depth, ProbeScratch& scratch, std::vector< double >& storeT )
+{
+    const int maxDepth = 12;
+
+    // Probe more than the midpoint so that e.g. a symmetric S-shape isn't mistaken for a line.
+    const std::array< double, 3 > probeFs{ 0.25, 0.5, 0.75 };
+    scratch.ts.resize( probeFs.size() );
+    for( size_t i = 0; i < probeFs.size(); i++ ) {
+        scratch.ts[ i ] = core::mathUtility::lerp( tA, tB, probeFs[ i ] );
+    }
+    s.curve().positionsAndDerivatives( scratch.ts, &scratch.positions, nullptr );
+    s.widths( scratch.ts, scratch.widths, scratch.widthPositions );
+
+    bool within = true;
+    for( size_t i = 0; i < probeFs.size() && within; i++ ) {
+        within = core::mathUtility::distToLineSegment( scratch.positions[ i ], pA, pB ) <= tol.chord
+              && std::abs( scratch.widths[ i ] - core::mathUtility::lerp( wA, wB, probeFs[ i ] ) ) <= tol.width;
+    }
+
+    if( within || depth >= maxDepth ) {
+        storeT.push_back( tB );
+        return;
+    }
+    // The recursion overwrites 'scratch', so keep the midpoint probe.
+    const auto tMid = scratch.ts[ 1 ];
+    const auto pMid = scratch.positions[ 1 ];
+    const auto wMid = scratch.widths[ 1 ];
+    subdivideWithin( s, tol, tA, pA, wA, tMid, pMid, wMid, depth + 1, scratch, storeT );
+    subdivideWithin( s, tol, tMid, pMid, wMid, tB, pB, wB, depth + 1, scratch, storeT );
+}
+
+/// Like 'tFromStroke', but place T values as needed to stay within 'tol' of 's', Bezier piece by piece.
+void adaptiveTFromStroke( const Stroke& s, const StrokePoly::Tolerance& tol, std::vector< double >& storeT )
+{
+    storeT.clear();
+    if( core::model::isSimpleSegStroke( s ) ) {
+        // Make debugging easier.
+        storeT = { 0., 1. };
+        return;
+    }
+
+    const auto& curve = s.curve();
+    // Piece boundaries include any corners.
+    const auto knots = curve.fullKnotsNoMultiples();
+    std::vector< Pos > knotPositions;
+    std::vector< double > knotWidths;
+    curve.positionsAndDerivatives( knots, &knotPositions, nullptr );
+    s.widths( knots, knotWidths );
+
+    ProbeScratch scratch;
+    storeT.push_back( knots.front() );
+    for( size_t i = 0; i + 1 < knots.size(); i++ ) {
+        subdivideWithin( s, tol,
+                         knots[ i ], knotPositions[ i ], knotWidths[ i ],
+                         knots[ i + 1 ], knotPositions[ i + 1 ], knotWidths[ i + 1 ],
+                         0, scratch, storeT );
+    }
+}
+
 void tFromStroke( const Stroke& s, size_t numPointsAskedFor, std::vector< double >& storeT )
 {
     if( core::model::isSimpleSegStroke( s ) ) {
@@ -83,7 +179,6 @@ void tFromStroke( const Stroke& s, size_t numPointsAskedFor, std::vector< double
 
 StrokePoly::StrokePoly()
     : stroke( nullptr )
-    , killForEachSeg( false )
 {
 }
 
@@ -92,53 +187,208 @@ StrokePoly::StrokePoly( const Stroke& s, size_t numPoints )
     initFrom( s, numPoints );
 }
 
+StrokePoly::StrokePoly( const Stroke& s, const Tolerance& tol )
+{
+    initFrom( s, tol );
+}
+
 bool StrokePoly::outlineCrosses( const Seg& seg ) const
 {
-    bool hitFound = false;
     Pos unused;
-    forEachSeg( [ & ]( const Seg& outlineSeg, const Normal&, double, double )
+    return !forEachSegNear( core::model::BoundingBox( seg.a, seg.b ), [ & ]( const Seg& outlineSeg, const Normal&, double, double )
     {
-        if( core::mathUtility::segmentsIntersect( seg, outlineSeg, unused ) ) {
-            hitFound = true;
-            killForEachSeg = true;
-        }
+        return !core::mathUtility::segmentsIntersect( seg, outlineSeg, unused );
     } );
-    return hitFound;
 }
 
 bool StrokePoly::contains( const Pos& p ) const
 {
+    // Descend into nodes whose bounds contain 'p'; skip over the others' subtrees.
+    size_t nodeIdx = 0;
+    while( nodeIdx < _quadNodes.size() ) {
+        const auto& node = _quadNodes[ nodeIdx ];
+        if( !node.bounds.contains( p ) ) {
+            nodeIdx = node.skip;
+        } else if( node.skip == nodeIdx + 1 ) {
+            for( auto i = node.firstQuad; i < node.lastQuad; i++ ) {
+                if( quadContains( i, p ) ) {
+                    return true;
+                }
+            }
+            nodeIdx = node.skip;
+        } else {
+            nodeIdx++;
+        }
+    }
+    return false;
+}
+
+core::model::BoundingBox StrokePoly::containsBounds() const
+{
+    return _quadNodes.empty() ? core::model::BoundingBox() : _quadNodes.front().bounds;
+}
+
+core::model::BoundingBox StrokePoly::quadBounds( size_t i, double& storeBuffer ) const
+{
+    core::model::BoundingBox ret;
+    ret.addPoint( sides[ Left ][ i ] );
+    ret.addPoint( sides[ Left ][ i + 1 ] );
+    ret.addPoint( sides[ Right ][ i ] );
+    ret.addPoint( sides[ Right ][ i + 1 ] );
+
+    // Don't want this to be too large in case of tris representing long, thin strokes.
+    storeBuffer = ret.minDim() * 1e-2;
+    return ret;
+}
+
+bool StrokePoly::quadContains( size_t i, const Pos& p ) const
+{
+    const auto& lA = sides[ Left ][ i ];
+    const auto& lB = sides[ Left ][ i + 1 ];
+    const auto& rA = sides[ Right ][ i ];
+    const auto& rB = sides[ Right ][ i + 1 ];
+
+    double buffer = 0.;
+    auto bounds = quadBounds( i, buffer );
+    bounds.expand( buffer );
+    if( bounds.contains( p ) ) {
+        if( pointInsideTri( p, lA, lB, rA, buffer ) ) {
+            return true;
+        }
+        if( pointInsideTri( p, rA, lB, rB, buffer ) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void StrokePoly::buildQuadNodes()
+{
+    _quadNodes.clear();
     const auto len = pointsPerSide();
     if( len < 2 ) {
-        return false;
+        return;
     }
+    buildQuadNodes( 0, len - 1 );
+}
 
-    for( size_t i = 0; i < len - 1; i++ ) {
-        const auto& lA = sides[ Left ][ i ];
-        const auto& lB = sides[ Left ][ i + 1 ];
-        const auto& rA = sides[ Right ][ i ];
-        const auto& rB = sides[ Right ][ i + 1 ];
-
-        core::model::BoundingBox bounds;
-        bounds.addPoint( lA );
-        bounds.addPoint( lB );
-        bounds.addPoint( rA );
-        bounds.addPoint( rB );
-
-        // Don't want this to be too large in case of tris representing long, thin strokes.
-        const auto buffer = bounds.minDim() * 1e-2;
-
-        bounds.expand( buffer );
-        if( bounds.contains( p ) ) {
-            if( pointInsideTri( p, lA, lB, rA, buffer ) ) {
-                return true;
+core::model::BoundingBox StrokePoly::buildQuadNodes( size_t first, size_t last )
+{
+    const size_t maxQuadsPerLeaf = 4;
+
+    const auto nodeIdx = _quadNodes.size();
+    _quadNodes.emplace_back();
+    core::model::BoundingBox bounds;
+    if( last - first <= maxQuadsPerLeaf ) {
+        for( auto i = first; i < last; i++ ) {
+            double buffer = 0.;
+            auto quad = quadBounds( i, buffer );
+            quad.expand( buffer );
+            bounds.growToContain( quad );
+        }
+    } else {
+        // Quads next to each other along the 'Stroke' are next to each other in space.
+        const auto mid = ( first + last ) / 2;
+        bounds.growToContain( buildQuadNodes( first, mid ) );
+        bounds.growToContain( buildQuadNodes( mid, last ) );
+    }
+
+    auto& node = _quadNodes[ nodeIdx ];
+    node.bounds = bounds;
+    node.firstQuad = first;
+    node.lastQuad = last;
+    node.skip = _quadNodes.size();
+    return bounds;
+}
+
+void StrokePoly::buildChains()
+{
+    for( size_t i = 0; i < NumSides; i++ ) {
+        auto& chains = _chains[ i ];
+        chains.clear();
+        const auto& side = sides[ i ];
+        if( side.size() < 2 ) {
+            continue;
+        }
+
+        MonotoneChain chain;
+        chain.bounds.addPoint( side[ 0 ] );
+        // 0 until the chain's direction is known.
+        int dir = 0;
+        for( size_t j = 1; j < side.size(); j++ ) {
+            const double dx = side[ j ].x() - side[ j - 1 ].x();
+            const int stepDir = dx > 0. ? 1 : ( dx < 0. ? -1 : 0 );
+            if( stepDir != 0 && dir != 0 && stepDir != dir ) {
+                // Start a new chain at the turning point.
+                chains.push_back( chain );
+                chain = MonotoneChain();
+                chain.first = j - 1;
+                chain.bounds.addPoint( side[ j - 1 ] );
+                dir = 0;
             }
-            if( pointInsideTri( p, rA, lB, rB, buffer ) ) {
-                return true;
+            if( dir == 0 ) {
+                dir = stepDir;
             }
+            chain.last = j;
+            chain.xIncreasing = dir >= 0;
+            chain.bounds.addPoint( side[ j ] );
         }
+        chains.push_back( chain );
     }
-    return false;
+}
+
+template< typename F >
+bool StrokePoly::forEachSegNear( const core::model::BoundingBox& box, F&& f_seg_norm_tA_tB ) const
+{
+    requireParticipates();
+
+    auto padded = box;
+    padded.expand( segHitSlack );
+    const auto segNear = [ & ]( const Pos& a, const Pos& b )
+    {
+        return core::model::BoundingBox( a, b ).intersects( padded );
+    };
+
+    // Same order as 'forEachSeg'.
+    for( size_t i = 0; i < NumSides; i++ ) {
+        const auto& side = sides[ i ];
+        const auto& sideNorms = sideNormals[ i ];
+        for( const auto& chain : _chains[ i ] ) {
+            if( !chain.bounds.intersects( padded ) ) {
+                continue;
+            }
+
+            // Segment 'j' spans points 'j' and 'j + 1'; find those overlapping 'padded' in x.
+            size_t begin = 0;
+            size_t end = 0;
+            if( chain.xIncreasing ) {
+                begin = partitionPoint( chain.first, chain.last, [ & ]( size_t j ) { return side[ j + 1 ].x() < padded.xMin(); } );
+                end = partitionPoint( begin, chain.last, [ & ]( size_t j ) { return side[ j ].x() <= padded.xMax(); } );
+            } else {
+                begin = partitionPoint( chain.first, chain.last, [ & ]( size_t j ) { return side[ j + 1 ].x() > padded.xMax(); } );
+                end = partitionPoint( begin, chain.last, [ & ]( size_t j ) { return side[ j ].x() >= padded.xMin(); } );
+            }
+            for( auto j = begin; j < end; j++ ) {
+                if( segNear( side[ j ], side[ j + 1 ] )
+                    && !f_seg_norm_tA_tB( Seg{ side[ j ], side[ j + 1 ] }, sideNorms[ j ], t[ j ], t[ j + 1 ] ) ) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // Include the "caps".
+    if( !closed() ) {
+        const Seg cap0{ sides[ Left ].front(), sides[ Right ].front() };
+        if( segNear( cap0.a, cap0.b ) && !f_seg_norm_tA_tB( cap0, *capNormal_T0, 0., 0. ) ) {
+            return false;
+        }
+        const Seg cap1{ sides[ Left ].back(), sides[ Right ].back() };
+        if( segNear( cap1.a, cap1.b ) && !f_seg_norm_tA_tB( cap1, *capNormal_T1, 1., 1. ) ) {
+            return false;
+        }
+    }
+    return true;
 }
 
 /// Return a point representing moving 'seekT' (in [0,1
@@ -171,37 +421,56 @@ void StrokePoly::initFrom( const Stroke& s, size_t numPointsAskedFor )
         return;
     }
 
-    if( stroke->closed() ) {
-        init_closed( numPointsAskedFor );
-    } else {
-        init_open( numPointsAskedFor );
-    }
+    tFromStroke( s, numPointsAskedFor, t );
+    initFromT();
 }
 
-void StrokePoly::init_open( size_t numPointsAskedFor )
+void StrokePoly::initFrom( const Stroke& s, const Tolerance& tol )
 {
-    const auto& s = *stroke;
+    stroke = &s;
 
     if( s.zeroLength() ) {
         // Leave 's' out of crossing calculations.
         return;
     }
+
+    adaptiveTFromStroke( s, tol, t );
+    initFromT();
+}
+
+void StrokePoly::initFromT()
+{
+    if( stroke->closed() ) {
+        init_closed();
+    } else {
+        init_open();
+    }
+    buildQuadNodes();
+    buildChains();
+}
+
+void StrokePoly::init_open()
+{
+    const auto& s = *stroke;
     const auto& curve = s.curve();
 
-    tFromStroke( s, numPointsAskedFor, t );
     const auto numPoints = t.size();
 
     for( size_t i = 0; i < NumSides; i++ ) {
         sides[ i ].resize( numPoints );
-        sideNormals[ i ].resize( numPoints - 1 );
     }
 
-    for( size_t i = 0; i < numPoints; i++ ) {
-        const auto t_i = t[ i ];
+    // Sample everything up front, in one pass per curve.
+    std::vector< core::Vector2 > positions;
+    std::vector< core::Vector2 > derivatives;
+    std::vector< double > widths;
+    curve.positionsAndDerivatives( t, &positions, &derivatives );
+    s.widths( t, widths );
 
-        const auto onS = curve.position( t_i );
-        const auto w = s.width( t_i );
-        auto dir = curve.derivative( t_i );
+    for( size_t i = 0; i < numPoints; i++ ) {
+        const auto& onS = positions[ i ];
+        const auto w = widths[ i ];
+        auto dir = derivatives[ i ];
         dir.normalize();
 
         // Note that I'm mentally modeling w.r.t. origin at top-left.
@@ -209,6 +478,17 @@ void StrokePoly::init_open( size_t numPointsAskedFor )
 
         for( size_t side = 0; side < NumSides; side++ ) {
             sides[ side ][ i ] = onS + toLeft * w * 0.5 * ( side == Left ? 1. : -1. );
+        }
+    }
+    init_openFromSides();
+}
+
+void StrokePoly::init_openFromSides()
+{
+    const auto numPoints = pointsPerSide();
+    for( size_t side = 0; side < NumSides; side++ ) {
+        sideNormals[ side ].resize( numPoints - 1 );
+        for( size_t i = 0; i < numPoints; i++ ) {
             bounds.addPoint( sides[ side ][ i ] );
             if( i > 0 ) {
                 sideNormals[ side ][ i - 1 ] = sides[ side ][ i ] - sides[ side ][ i - 1 ];
@@ -227,25 +507,84 @@ void StrokePoly::init_open( size_t numPointsAskedFor )
     capNormal_T1->normalize();
 }
 
-void StrokePoly::init_closed( size_t numPointsAskedFor )
+StrokePoly StrokePoly::slice( double tA, double tB ) const
+{
+    requireParticipates();
+    if( tA == tB ) {
+        THROW_RUNTIME( "Can't slice an empty T interval" );
+    }
+
+    const auto tLo = std::max( std::min( tA, tB ), t.front() );
+    const auto tHi = std::min( std::max( tA, tB ), t.back() );
+    // The samples strictly inside ('tLo','tHi') are kept as they are.
+    const auto iBegin = static_cast< size_t >( std::upper_bound( t.begin(), t.end(), tLo ) - t.begin() );
+    const auto iEnd = static_cast< size_t >( std::lower_bound( t.begin(), t.end(), tHi ) - t.begin() );
+
+    // Return the point of side 'side' at 'tSeek', interpolating along the segment holding it.
+    const auto ribPoint = [ this ]( size_t side, double tSeek )
+    {
+        const auto upper = static_cast< size_t >( std::lower_bound( t.begin(), t.end(), tSeek ) - t.begin() );
+        if( upper == 0 ) {
+            return sides[ side ].front();
+        } else if( upper == t.size() ) {
+            return sides[ side ].back();
+        }
+        const auto tPrev = t[ upper - 1 ];
+        const auto tNext = t[ upper ];
+        return Pos::lerp( sides[ side ][ upper - 1 ], sides[ side ][ upper ], ( tSeek - tPrev ) / ( tNext - tPrev ) );
+    };
+
+    StrokePoly ret;
+    ret.stroke = stroke;
+    const auto numPoints = iEnd - iBegin + 2;
+    ret.t.reserve( numPoints );
+    ret.t.push_back( 0. );
+    for( auto i = iBegin; i < iEnd; i++ ) {
+        ret.t.push_back( ( t[ i ] - tLo ) / ( tHi - tLo ) );
+    }
+    ret.t.push_back( 1. );
+    for( size_t side = 0; side < NumSides; side++ ) {
+        auto& retSide = ret.sides[ side ];
+        retSide.resize( numPoints );
+        retSide[ 0 ] = ribPoint( side, tLo );
+        for( auto i = iBegin; i < iEnd; i++ ) {
+            retSide[ i - iBegin + 1 ] = sides[ side ][ i ];
+        }
+        retSide[ numPoints - 1 ] = ribPoint( side, tHi );
+    }
+
+    if( tA > tB ) {
+        // Walking backwards along 'stroke' swaps its left and right.
+        std::reverse( ret.t.begin(), ret.t.end() );
+        for( auto& tSlice : ret.t ) {
+            tSlice = 1. - tSlice;
+        }
+        for( auto& side : ret.sides ) {
+            std::reverse( side.begin(), side.end() );
+        }
+        std::swap( ret.sides[ Left ], ret.sides[ Right ] );
+    }
+
+    ret.init_openFromSides();
+    ret.buildQuadNodes();
+    ret.buildChains();
+    return ret;
+}
+
+void StrokePoly::init_closed()
 {
     const auto& s = *stroke;
 
-    tFromStroke( s, numPointsAskedFor, t );
     const auto numP = t.size();
     if( numP < 2 ) {
         THROW_UNEXPECTED;
     }
 
     const auto& curve = s.curve();
-    std::vector< core::Vector2 > pos( numP );
-    std::vector< double > baseWidths( numP );
-
-    for( size_t i = 0; i < numP; i++ ) {
-        const auto& tVal = t[ i ];
-        pos[ i ] = curve.position( tVal );
-        baseWidths[ i ] = s.width( tVal );
-    }
+    std::vector< core::Vector2 > pos;
+    std::vector< double > baseWidths;
+    curve.positionsAndDerivatives( t, &pos, nullptr );
+    s.widths( t, baseWidths );
 
     printCurves::miteredOffsetSamples(
         pos,
@@ -270,43 +609,11 @@ void StrokePoly::init_closed( size_t numPointsAskedFor )
     }
 }
 
-void StrokePoly::forEachSeg( std::function< void( const Seg&, const Normal&, double, double ) > f_seg_norm_tA_tB ) const
+void StrokePoly::requireParticipates() const
 {
-    killForEachSeg = false;
-
     if( !participates() ) {
         THROW_RUNTIME( "Can't call on 'non-participating' StrokePoly" );
     }
-
-    // Apply 'f...' to all the segments of each side.
-    for( size_t i = 0; i < NumSides && !killForEachSeg; i++ ) {
-        const auto& side = sides[ i ];
-        const auto& sideNorms = sideNormals[ i ];
-        for( size_t i = 0; i < side.size() - 1; i++ ) {
-            const auto tA = t[ i ];
-            const auto tB = t[ i + 1 ];
-            const Seg seg{ side[ i ], side[ i + 1 ] };
-            f_seg_norm_tA_tB( seg, sideNorms[ i ], tA, tB );
-        }
-    }
-    if( killForEachSeg ) {
-        return;
-    }
-
-    // Include the "caps".
-    if( !closed() ) {
-        f_seg_norm_tA_tB( Seg{ sides[ Left ].front(), sides[ Right ].front() },
-                         *capNormal_T0,
-                         0.,
-                         0. );
-        if( killForEachSeg ) {
-            return;
-        }
-        f_seg_norm_tA_tB( Seg{ sides[ Left ].back(), sides[ Right ].back() },
-                         *capNormal_T1,
-                         1.,
-                         1. );
-    }
 }
 
 size_t StrokePoly::pointsPerSide() const
@@ -334,13 +641,14 @@ std::vector< double > StrokePoly::hitTs( const core::model::Polyline& hitter ) c
             continue;
         }
 
-        forEachSeg(
+        forEachSegNear( segBounds,
         [ & ]( const core::model::Seg& ab, const Normal&, double tA, double tB )
         {
             core::model::Pos hit;
             if( core::mathUtility::segmentsIntersect( a_hitter, b_hitter, ab.a, ab.b, hit ) ) {
                 ret.push_back( core::mathUtility::lerp( tA, tB, ab.t( hit ) ) );
             }
+            return true;
         } );
     }
     return ret;
@@ -360,17 +668,13 @@ bool StrokePoly::hitsAtAll( const core::model::Polyline& hitter ) const
             continue;
         }
 
-        bool hitFound = false;
-        forEachSeg(
+        const bool noHit = forEachSegNear( segBounds,
         [ & ]( const core::model::Seg& ab, const Normal&, double, double )
         {
             core::model::Pos hit;
-            if( core::mathUtility::segmentsIntersect( a_hitter, b_hitter, ab.a, ab.b, hit ) ) {
-                killForEachSeg = true;
-                hitFound = true;
-            }
+            return !core::mathUtility::segmentsIntersect( a_hitter, b_hitter, ab.a, ab.b, hit );
         } );
-        if( hitFound ) {
+        if( !noHit ) {
             return true;
         }
     }
@@ -6,12 +6,13 @@
 #include <Mashup/strokeside.h>
 
 #include <Core/model/boundingboxback.h>
-#include <Core/model/lineforward.h>
+#include <Core/model/lineback.h>
 #include <Core/model/polyline.h>
 
 #include <Core/utility/boundingbox.h>
 
 #include <functional>
+#include <vector>
 
 namespace mashup {
 
@@ -21,28 +22,48 @@ struct StrokePoly
     using Normal = core::model::Pos;
     using Normals = core::model::Polyline;
 
+    /// How closely an adaptively placed 'StrokePoly' follows its 'Stroke' (both in canvas space, >0).
+    struct Tolerance
+    {
+        /// How far the spine may stray from the 'Stroke''s curve.
+        double chord = 0.25;
+        /// How far the (linearly interpolated) width may stray from the 'Stroke''s.
+        double width = 0.25;
+    };
+
     StrokePoly();
     /// Let 'affil' indicate which 'Drawing' (if any) 's' is associated with along its entire length.
     /// 'numPoints' is a guide; do not expect it to be exactly honored in result.
     StrokePoly( const Stroke& s, size_t numPoints );
+    /// Subdivide each Bezier piece of 's' until within 'tol' of 's'.
+    StrokePoly( const Stroke& s, const Tolerance& tol );
     /// 'numPoints' is a guide; do not expect it to be exactly honored in result.
     void initFrom( const Stroke& s, size_t numPoints );
+    void initFrom( const Stroke& s, const Tolerance& tol );
     /// Does 'this' represent a closed 'Stroke'?
     bool closed() const;
     bool outlineCrosses( const core::model::Seg& seg ) const;
     bool contains( const core::model::Pos& p ) const;
+    /// Return a box outside of which 'contains' is false (empty if it is false everywhere).
+    core::model::BoundingBox containsBounds() const;
+
+    /// Return the (open) part of 'this' between 'tA' and 'tB' (which may be ordered either way, like a
+    /// 'Substroke''s), reusing 'this''s samples and interpolating only the two new end ribs; its 't'
+    /// runs from 0 at 'tA' to 1 at 'tB'. Much cheaper than re-tessellating the sub-'Stroke'.
+    StrokePoly slice( double tA, double tB ) const;
 
     /// Return a point representing moving 'seekT' (in [0,1]) alone the indicated side.
     core::model::Pos onSide( double seekT, StrokeSide sideIdx ) const;
 
-    /// Call 'f...' on all the segments (in no particular order) of the polygon.
+    /// Call 'f...' on all the segments (in no particular order) of the polygon, stopping as soon as
+    /// 'f...' returns false. Return false iff stopped.
     /// f's arguments
     ///     (0) segment
     ///     (1) normal of segment that (locally) points outside the 'Stroke'
     ///     (2) stroke T at start of segment
     ///     (3) stroke T at end of segment
-    ///     (4) drawing affiliation of the segment
-    void forEachSeg( std::function< void( const core::model::Seg&, const Normal&, double, double ) > f_seg_norm_tA_tB ) const;
+    template< typename F >
+    bool forEachSeg( F&& f_seg_norm_tA_tB ) const;
     size_t pointsPerSide() const;
     bool participates() const;
 
@@ -66,12 +87,85 @@ struct StrokePoly
     boost::optional< Normal > capNormal_T0;
     boost::optional< Normal > capNormal_T1;
 
-    /// A crude way of ending 'forEachSeg' early.
-    mutable bool killForEachSeg = false;
 private:
-    void init_open( size_t numPoints );
-    void init_closed( size_t numPoints );
+    /// Throw unless 'this' "participates".
+    void requireParticipates() const;
+
+    /// A node of a bounding-volume hierarchy over the quads between consecutive points of 'sides'
+    /// (quad 'i' spans points 'i' and 'i + 1'), covering quads ['firstQuad','lastQuad'), all of which
+    /// lie in 'bounds' even after 'contains' pads them. Nodes are stored depth-first, so a node's first
+    /// child follows it, and 'skip' is the index of the node just past its subtree.
+    struct QuadNode
+    {
+        core::model::BoundingBox bounds;
+        size_t firstQuad = 0;
+        size_t lastQuad = 0;
+        size_t skip = 0;
+    };
+
+    /// Finish initializing from 'stroke' and 't'.
+    void initFromT();
+    void init_open();
+    /// Finish 'init_open' once 'sides' are in place.
+    void init_openFromSides();
+    void init_closed();
+
+    /// Return the bounding box of quad 'i', and store in 'storeBuffer' how far 'contains' pads it.
+    core::model::BoundingBox quadBounds( size_t i, double& storeBuffer ) const;
+    /// Return whether 'p' is inside quad 'i' (with padding).
+    bool quadContains( size_t i, const core::model::Pos& p ) const;
+    void buildQuadNodes();
+    /// Append the subtree covering quads ['first','last') to '_quadNodes'; return its bounds.
+    core::model::BoundingBox buildQuadNodes( size_t first, size_t last );
+
+    /// A run of points ['first','last'] of one of 'sides' whose x coordinates never decrease (or, if
+    /// not 'xIncreasing', never increase), so the segments overlapping an x range are contiguous.
+    struct MonotoneChain
+    {
+        core::model::BoundingBox bounds;
+        size_t first = 0;
+        size_t last = 0;
+        bool xIncreasing = true;
+    };
+
+    void buildChains();
+    /// Like 'forEachSeg', but skip segments that cannot cross anything inside 'box'.
+    template< typename F >
+    bool forEachSegNear( const core::model::BoundingBox& box, F&& f_seg_norm_tA_tB ) const;
+
+    std::vector< QuadNode > _quadNodes;
+    /// Cover the segments of the corresponding 'sides', in order.
+    std::vector< MonotoneChain > _chains[ NumSides ];
 };
+
+template< typename F >
+bool StrokePoly::forEachSeg( F&& f_seg_norm_tA_tB ) const
+{
+    requireParticipates();
+
+    // Apply 'f...' to all the segments of each side.
+    for( size_t i = 0; i < NumSides; i++ ) {
+        const auto& side = sides[ i ];
+        const auto& sideNorms = sideNormals[ i ];
+        for( size_t j = 0; j < side.size() - 1; j++ ) {
+            if( !f_seg_norm_tA_tB( core::model::Seg{ side[ j ], side[ j + 1 ] }, sideNorms[ j ], t[ j ], t[ j + 1 ] ) ) {
+                return false;
+            }
+        }
+    }
+
+    // Include the "caps".
+    if( !closed() ) {
+        if( !f_seg_norm_tA_tB( core::model::Seg{ sides[ Left ].front(), sides[ Right ].front() }, *capNormal_T0, 0., 0. ) ) {
+            return false;
+        }
+        if( !f_seg_norm_tA_tB( core::model::Seg{ sides[ Left ].back(), sides[ Right ].back() }, *capNormal_T1, 1., 1. ) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
 using StrokePolys = std::vector< StrokePoly >;
 using StrokePolyHandles = std::vector< const StrokePoly* >;
 
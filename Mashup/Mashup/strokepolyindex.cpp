@@ -0,0 +1,147 @@
+#include <strokepolyindex.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace mashup {
+
+template< typename F >
+void StrokePolyIndex::forEachCellOver( const core::model::BoundingBox& box, F&& f )
+{
+    int xMin = 0, yMin = 0, xMax = 0, yMax = 0;
+    cellCoords( box.topLeft(), xMin, yMin );
+    cellCoords( box.bottomRight(), xMax, yMax );
+    for( int x = xMin; x <= xMax; x++ ) {
+        for( int y = yMin; y <= yMax; y++ ) {
+            f( _cells.getRef( x, y ) );
+        }
+    }
+}
+
+StrokePolyIndex::StrokePolyIndex( const StrokePolyHandles& polys )
+{
+    StrokePolyHandles participating;
+    std::vector< core::model::BoundingBox > polyBounds;
+    for( const auto* const poly : polys ) {
+        if( poly->participates() ) {
+            participating.push_back( poly );
+            polyBounds.push_back( poly->containsBounds() );
+            _bounds.growToContain( polyBounds.back() );
+        }
+    }
+    if( participating.empty() ) {
+        return;
+    }
+
+    // About one cell per 'StrokePoly', up to a limit.
+    const double maxCellsDim = 256.;
+    const double cellsDim = std::clamp( std::ceil( std::sqrt( static_cast< double >( participating.size() ) ) ), 1., maxCellsDim );
+    _cellWidth = std::max( _bounds.maxDim() / cellsDim, 1e-9 );
+    _cells.recreate( std::max( static_cast< int >( std::ceil( _bounds.widthExclusive() / _cellWidth ) ), 1 ),
+                     std::max( static_cast< int >( std::ceil( _bounds.heightExclusive() / _cellWidth ) ), 1 ) );
+
+    for( size_t i = 0; i < participating.size(); i++ ) {
+        forEachCellOver( polyBounds[ i ], [ & ]( StrokePolyHandles& cell )
+        {
+            cell.push_back( participating[ i ] );
+        } );
+    }
+}
+
+void StrokePolyIndex::add( const StrokePoly* poly )
+{
+    if( !poly->participates() ) {
+        return;
+    }
+    const auto box = poly->containsBounds();
+    if( !_bounds.contains( box ) ) {
+        _outside.push_back( poly );
+        return;
+    }
+    forEachCellOver( box, [ & ]( StrokePolyHandles& cell )
+    {
+        cell.push_back( poly );
+    } );
+}
+
+void StrokePolyIndex::remove( const StrokePoly* poly )
+{
+    const auto erase = [ poly ]( StrokePolyHandles& polys )
+    {
+        polys.erase( std::remove( polys.begin(), polys.end(), poly ), polys.end() );
+    };
+    if( !poly->participates() ) {
+        return;
+    }
+    const auto box = poly->containsBounds();
+    if( !_bounds.contains( box ) ) {
+        erase( _outside );
+        return;
+    }
+    forEachCellOver( box, erase );
+}
+
+bool StrokePolyIndex::anyContains( const core::model::Pos& p ) const
+{
+    for( const auto* const poly : _outside ) {
+        if( poly->contains( p ) ) {
+            return true;
+        }
+    }
+    int x = 0, y = 0;
+    if( !cellCoords( p, x, y ) ) {
+        return false;
+    }
+    for( const auto* const poly : _cells.getRef( x, y ) ) {
+        if( poly->contains( p ) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+StrokePolyHandles StrokePolyIndex::polysNear( const core::model::BoundingBox& box ) const
+{
+    StrokePolyHandles ret;
+    for( const auto* const poly : _outside ) {
+        if( poly->containsBounds().intersects( box ) ) {
+            ret.push_back( poly );
+        }
+    }
+    if( !_bounds.intersects( box ) ) {
+        return ret;
+    }
+
+    const auto topLeft = _bounds.topLeft();
+    const auto cellX = [ & ]( double x )
+    {
+        return std::clamp( static_cast< int >( ( x - topLeft.x() ) / _cellWidth ), 0, _cells.width() - 1 );
+    };
+    const auto cellY = [ & ]( double y )
+    {
+        return std::clamp( static_cast< int >( ( y - topLeft.y() ) / _cellWidth ), 0, _cells.height() - 1 );
+    };
+    for( int x = cellX( box.xMin() ); x <= cellX( box.xMax() ); x++ ) {
+        for( int y = cellY( box.yMin() ); y <= cellY( box.yMax() ); y++ ) {
+            const auto& cell = _cells.getRef( x, y );
+            ret.insert( ret.end(), cell.begin(), cell.end() );
+        }
+    }
+    // A 'StrokePoly' can be in several of the cells.
+    std::sort( ret.begin(), ret.end() );
+    ret.erase( std::unique( ret.begin(), ret.end() ), ret.end() );
+    return ret;
+}
+
+bool StrokePolyIndex::cellCoords( const core::model::Pos& p, int& storeX, int& storeY ) const
+{
+    if( !_bounds.contains( p ) ) {
+        return false;
+    }
+    const auto topLeft = _bounds.topLeft();
+    storeX = std::clamp( static_cast< int >( ( p.x() - topLeft.x() ) / _cellWidth ), 0, _cells.width() - 1 );
+    storeY = std::clamp( static_cast< int >( ( p.y() - topLeft.y() ) / _cellWidth ), 0, _cells.height() - 1 );
+    return true;
+}
+
+} // mashup
@@ -0,0 +1,52 @@
+#ifndef MASHUP_STROKEPOLYINDEX_H
+#define MASHUP_STROKEPOLYINDEX_H
+
+#include <Mashup/strokepoly.h>
+
+#include <Core/model/boundingboxback.h>
+#include <Core/model/posback.h>
+
+#include <Core/utility/twodarray.h>
+
+#include <vector>
+
+namespace mashup {
+
+/// A uniform grid over the bounding boxes of a set of 'StrokePoly's, for finding the few whose
+/// bounds contain a point without looking at all of them.
+///
+/// The grid is laid out for the 'StrokePoly's given on construction. Those 'add'ed later that stick
+/// out of it are kept in a list that every query looks through.
+class StrokePolyIndex
+{
+public:
+    /// The 'StrokePoly's behind 'polys' must outlive 'this' (or their 'remove') and not change in the meantime.
+    explicit StrokePolyIndex( const StrokePolyHandles& polys );
+
+    /// Index 'poly' too (if it participates), on the same terms as those given on construction.
+    void add( const StrokePoly* poly );
+    /// Stop indexing 'poly' (if indexed).
+    void remove( const StrokePoly* poly );
+
+    /// Return whether some indexed 'StrokePoly' contains 'p'.
+    bool anyContains( const core::model::Pos& p ) const;
+    /// Return (once each, in no particular order) the indexed 'StrokePoly's whose 'containsBounds' might
+    /// intersect 'box'; a superset of those whose 'bounds' do.
+    StrokePolyHandles polysNear( const core::model::BoundingBox& box ) const;
+private:
+    /// Return the cell holding 'p', or false if it lies outside the grid.
+    bool cellCoords( const core::model::Pos& p, int& storeX, int& storeY ) const;
+    /// Call 'f( cell )' for each cell that 'box' (which must lie within '_bounds') overlaps.
+    template< typename F >
+    void forEachCellOver( const core::model::BoundingBox& box, F&& f );
+
+    core::model::BoundingBox _bounds;
+    double _cellWidth = 1.;
+    core::TwoDArray< StrokePolyHandles > _cells;
+    /// The indexed 'StrokePoly's that do not fit in '_bounds'.
+    StrokePolyHandles _outside;
+};
+
+} // mashup
+
+#endif // #include
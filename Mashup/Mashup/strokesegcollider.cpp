@@ -12,8 +12,11 @@
 
 #include <Core/utility/boundinginterval.h>
 #include <Core/utility/mathutility.h>
+#include <Core/utility/parallelfor.h>
+#include <Core/utility/visitstamps.h>
 
 #include <algorithm>
+#include <limits>
 #include <set>
 
 namespace mashup {
@@ -24,93 +27,226 @@ using AB = core::model::Seg;
 using Polyline= core::model::Polyline;
 using SegID = StrokeSegColliderMetadata::SegID;
 
-StrokeSegCollider::StrokeSegCollider( const core::model::BoundingBox& canvasBounds )
-    : Base( canvasBounds, 100 )
-    , _nextSegID( 0 )
+namespace {
+
+/// How far beyond the exact crossing point 'segmentsIntersect' may report a hit.
+const double hitDistTolerance = 1e-6;
+
+} // unnamed
+
+StrokeSegCollider::StrokeSegCollider( const core::model::BoundingBox& canvasBounds, core::math::SegIndexType indexType )
+    : Base( canvasBounds, 100, indexType )
 {
 }
 
-void StrokeSegCollider::removeStroke( StrokeHandle stroke )
+StrokeSegCollider::StrokeSegCollider( const StrokeSegCollider& base, std::function< bool( StrokeHandle ) > includeStroke )
+    : Base( base.bounds(), 100, base.indexType() )
+    , _baseLayer( &base )
+    , _baseIncludeStroke( includeStroke )
 {
-    for( const auto& coords : _strokeToInvolvedCoords[ stroke ] ) {
-        auto& bin = _grid.getRef( coords );
-        CellContents filtered;
-        for( const auto& pair : bin ) {
-            if( !( pair.metadata.stroke == stroke ) ) {
-                filtered.push_back( pair );
-            }
+    if( base._baseLayer ) {
+        THROW_RUNTIME( "Cannot layer a StrokeSegCollider over a layered one" );
+    }
+    _firstOwnID = static_cast< SegID >( base._segs.size() );
+    if( indexType() == core::math::UniformGrid && base.gridParams().cellWidth != gridParams().cellWidth ) {
+        setCellWidth( base.gridParams().cellWidth, std::numeric_limits< size_t >::max() );
+    }
+
+    // Segments of a 'Stroke' are mostly consecutive, so only ask about each 'Stroke' once per run.
+    _baseIncluded.resize( base._segs.size() );
+    StrokeHandle lastStroke = nullptr;
+    bool lastIncluded = false;
+    for( size_t i = 0; i < base._segs.size(); i++ ) {
+        const auto stroke = base._segs[ i ].metadata.stroke;
+        if( i == 0 || stroke != lastStroke ) {
+            lastStroke = stroke;
+            lastIncluded = includeStroke( stroke );
         }
-        bin = filtered;
+        _baseIncluded[ i ] = lastIncluded;
     }
-    _strokeToInvolvedCoords[ stroke ].clear();
+}
 
-    // _idToSWD
+StrokeSegCollider::SWDPredicate StrokeSegCollider::basePred( SWDPredicate pred ) const
+{
+    return [ this, pred ]( const SegWithData& swd )
     {
-        decltype( _idToSWD ) backup;
-        // https://www.techiedelight.com/filter-a-map-in-cpp/
-        std::copy_if(
-            _idToSWD.begin(),
-            _idToSWD.end(),
-            std::inserter( backup, backup.begin() ),
-            [ &stroke ]( const std::pair< SegID, SegWithData >& pair )
-            {
-                return pair.second.metadata.stroke != stroke;
-            } );
-        _idToSWD = std::move( backup );
+        return _baseIncluded[ swd.metadata.segID ] && ( !pred || pred( swd ) );
+    };
+}
+
+const StrokeSegCollider::SegWithData& StrokeSegCollider::segWithID( SegID id ) const
+{
+    if( id < _firstOwnID ) {
+        return _baseLayer->segWithData( id );
     }
+    return segWithData( id - _firstOwnID );
 }
 
-std::vector< StrokeSegCollider::SegWithData > StrokeSegCollider::strokeSegsWithinRange( const IPos& xy, double range ) const
+const StrokeSegColdMetadata& StrokeSegCollider::coldMetadata( SegID id ) const
 {
-    const auto cx = xy.x();
-    const auto cy = xy.y();
+    if( id < _firstOwnID ) {
+        return _baseLayer->_cold[ id ];
+    }
+    return _cold[ id - _firstOwnID ];
+}
 
-    const int nw = static_cast< int >( neighborhoodWidth( range ) );
-    const int halfNW = nw / 2;
+double StrokeSegCollider::strokeT( SegID id, double f ) const
+{
+    const auto& t = coldMetadata( id ).t;
+    return core::mathUtility::lerp( t[ 0 ], t[ 1 ], f );
+}
 
-    std::set< SegID > segIds;
-    std::vector< SegWithData > ret;
-    for( int x = cx - halfNW; x <= cx + halfNW; x++ ) {
-        for( int y = cy - halfNW; y <= cy + halfNW; y++ ) {
-            if( _grid.isValidCoord( x, y ) ) {
-                const auto& bin = _grid.getRef( x, y );
-                for( const auto& pair : bin ) {
-                    if( segIds.find( pair.metadata.segID ) != segIds.end() ) {
-                        continue;
-                    } else {
-                        segIds.emplace( pair.metadata.segID );
-                    }
-
-                    SegWithData seg;
-                    seg.seg = pair.seg;
-                    seg.metadata = pair.metadata;
-                    ret.push_back( seg );
-                }
+StrokeSegCollider::MetadataPredicate StrokeSegCollider::baseMetadataPred( MetadataPredicate segsToConsider ) const
+{
+    return [ this, segsToConsider ]( const Metadata& m )
+    {
+        return _baseIncluded[ m.segID ] && ( !segsToConsider || segsToConsider( m ) );
+    };
+}
+
+boost::optional< double > StrokeSegCollider::distToNearestSeg( const Pos& posCanvas, MetadataPredicate segsToConsider, double maxDistAllowed ) const
+{
+    auto ret = Base::distToNearestSeg( posCanvas, segsToConsider, maxDistAllowed );
+    if( _baseLayer ) {
+        const auto baseDist = _baseLayer->Base::distToNearestSeg( posCanvas, baseMetadataPred( segsToConsider ), maxDistAllowed );
+        if( baseDist && ( !ret || *baseDist < *ret ) ) {
+            ret = baseDist;
+        }
+    }
+    return ret;
+}
+
+std::vector< boost::optional< double > > StrokeSegCollider::distsToNearestSeg(
+    const std::vector< Pos >& positions, MetadataPredicate segsToConsider, const std::vector< double >& maxDistsAllowed ) const
+{
+    auto ret = Base::distsToNearestSeg( positions, segsToConsider, maxDistsAllowed );
+    if( _baseLayer ) {
+        const auto baseDists = _baseLayer->Base::distsToNearestSeg( positions, baseMetadataPred( segsToConsider ), maxDistsAllowed );
+        for( size_t i = 0; i < ret.size(); i++ ) {
+            if( baseDists[ i ] && ( !ret[ i ] || *baseDists[ i ] < *ret[ i ] ) ) {
+                ret[ i ] = baseDists[ i ];
             }
         }
     }
     return ret;
 }
 
+void StrokeSegCollider::removeStroke( StrokeHandle stroke )
+{
+    const auto it = _strokeToSegs.find( stroke );
+    if( it != _strokeToSegs.end() ) {
+        removeSegs( it->second );
+        _strokeToSegs.erase( it );
+    }
+    if( poolIsSparse() ) {
+        compactPool();
+    }
+}
+
+void StrokeSegCollider::compactPool()
+{
+    const auto oldToNew = Base::compactPool();
+    const auto newID = [ & ]( SegID id )
+    {
+        return id == Metadata::noSegID ? id : _firstOwnID + static_cast< SegID >( oldToNew[ id - _firstOwnID ] );
+    };
+
+    size_t numLive = 0;
+    for( size_t idx = 0; idx < oldToNew.size(); idx++ ) {
+        if( oldToNew[ idx ] != noSegIndex ) {
+            auto& cold = _cold[ numLive++ ];
+            cold = _cold[ idx ];
+            cold.next = newID( cold.next );
+            cold.prev = newID( cold.prev );
+        }
+    }
+    _cold.resize( numLive );
+
+    for( auto& swd : _segs ) {
+        swd.metadata.segID = newID( swd.metadata.segID );
+    }
+    for( auto& pair : _strokeToSegs ) {
+        for( auto& idx : pair.second ) {
+            idx = oldToNew[ idx ];
+        }
+    }
+}
+
+std::vector< StrokeSegCollider::SegWithData > StrokeSegCollider::strokeSegsWithinRange( const IPos& xy, double range ) const
+{
+    std::vector< SegWithData > ret;
+    forEachStrokeSegWithinRange( xy, range,
+    [ &ret ]( const SegWithData& swd )
+    {
+        ret.push_back( swd );
+        return true;
+    } );
+    return ret;
+}
+
 std::vector< StrokeSegCollider::SegWithData > StrokeSegCollider::strokeSegsWithinRange( const Pos& posCanvas, double range ) const
 {
     return strokeSegsWithinRange( cellCoords( posCanvas ), range );
 }
 
 void StrokeSegCollider::addStroke( const StrokePoly& sPoly )
+{
+    SegsWithData swds;
+    strokeSegs( sPoly, _firstOwnID + static_cast< SegID >( _segs.size() ), swds, _cold );
+    if( swds.empty() ) {
+        return;
+    }
+
+    auto& slots = _strokeToSegs[ sPoly.stroke ];
+    for( const auto& swd : swds ) {
+        const auto idx = addSeg( swd.seg, swd.metadata );
+        if( _firstOwnID + idx != swd.metadata.segID ) {
+            THROW_UNEXPECTED;
+        }
+        slots.push_back( idx );
+    }
+}
+
+void StrokeSegCollider::autoTuneCells( size_t maxCells )
+{
+    _autoTuneMaxCells = maxCells;
+}
+
+boost::optional< StrokeSegCollider::GridParams > StrokeSegCollider::tunedGridParams() const
+{
+    return _tunedGrid;
+}
+
+void StrokeSegCollider::bulkLoad( const StrokePolyHandles& sPolys )
+{
+    _strokeToSegs.clear();
+
+    SegsWithData swds;
+    _cold.clear();
+    for( const auto* const sPoly : sPolys ) {
+        const auto firstIdx = static_cast< SegIndex >( swds.size() );
+        strokeSegs( *sPoly, _firstOwnID, swds, _cold );
+        auto& slots = _strokeToSegs[ sPoly->stroke ];
+        for( auto idx = firstIdx; idx < static_cast< SegIndex >( swds.size() ); idx++ ) {
+            slots.push_back( idx );
+        }
+    }
+    if( _autoTuneMaxCells > 0 && indexType() == core::math::UniformGrid ) {
+        clear();
+        setCellWidth( tunedCellWidth( swds, bounds() ), _autoTuneMaxCells );
+        _tunedGrid = gridParams();
+    }
+    Base::bulkLoad( std::move( swds ) );
+}
+
+void StrokeSegCollider::strokeSegs( const StrokePoly& sPoly, SegID firstID, SegsWithData& store,
+                                    std::vector< StrokeSegColdMetadata >& storeCold )
 {
     if( !sPoly.participates() ) {
         return;
     }
 
     const auto* const stroke = sPoly.stroke;
-    auto& involvedCoords = _strokeToInvolvedCoords[ stroke ];
-
-    const auto addSWD = [ & ]( const SegWithData& swd )
-    {
-        addSeg( swd.seg, swd.metadata, &involvedCoords );
-        _idToSWD[ swd.metadata.segID ] = swd;
-    };
 
     // The two offset curves of the 'Stroke'
     const auto& t = sPoly.t;
@@ -119,6 +255,7 @@ void StrokeSegCollider::addStroke( const StrokePoly& sPoly )
         const auto& sideNorms = sPoly.sideNormals[ i ];
         const auto numSegs = sideNorms.size();
         SegsWithData swd( numSegs );
+        std::vector< StrokeSegColdMetadata > cold( numSegs );
 
         for( size_t i = 0; i < numSegs; i++ ) {
             const auto tA = t[ i ];
@@ -127,32 +264,25 @@ void StrokeSegCollider::addStroke( const StrokePoly& sPoly )
 
             auto& meta = swd[ i ].metadata;
             meta.normal = sideNorms[ i ];
-            meta.t = { tA, tB };
             meta.stroke = stroke;
-            meta.segID = _nextSegID++;
+            meta.segID = firstID + static_cast< SegID >( store.size() + i );
+            cold[ i ].t = { tA, tB };
         }
-        // break 'SegID' sequence (for debugging, not necessary)
-        _nextSegID++;
 
         // make inter-seg connections.
         if( numSegs > 1 ) {
             for( size_t i = 0; i < numSegs - 1; i++ ) {
-                auto& swdA = swd[ i ];
-                auto& swdB = swd[ i + 1 ];
-                swdA.metadata.next = swdB.metadata.segID;
-                swdB.metadata.prev = swdA.metadata.segID;
+                cold[ i ].next = swd[ i + 1 ].metadata.segID;
+                cold[ i + 1 ].prev = swd[ i ].metadata.segID;
             }
             if( sPoly.closed() ) {
-                auto& last = swd.back();
-                auto& first = swd.front();
-                last.metadata.next = first.metadata.segID;
-                first.metadata.prev = last.metadata.segID;
+                cold.back().next = swd.front().metadata.segID;
+                cold.front().prev = swd.back().metadata.segID;
             }
         }
 
-        for( const auto& toAdd : swd ) {
-            addSWD( toAdd );
-        }
+        store.insert( store.end(), swd.begin(), swd.end() );
+        storeCold.insert( storeCold.end(), cold.begin(), cold.end() );
     }
 
     // Start/end caps
@@ -160,91 +290,152 @@ void StrokeSegCollider::addStroke( const StrokePoly& sPoly )
         SegWithData startCap;
         startCap.seg = AB{ sPoly.sides[ Left ].front(), sPoly.sides[ Right ].front() };
         startCap.metadata.normal = *sPoly.capNormal_T0;
-        startCap.metadata.t = { 0., 0. };
         startCap.metadata.stroke = stroke;
         startCap.metadata.isCap = true;
-        startCap.metadata.segID = _nextSegID++;
-        // break 'SegID' sequence (for debugging, not necessary)
-        _nextSegID++;
-        addSWD( startCap );
+        startCap.metadata.segID = firstID + static_cast< SegID >( store.size() );
+        store.push_back( startCap );
+        storeCold.push_back( StrokeSegColdMetadata{ { 0., 0. } } );
 
         SegWithData endCap;
         endCap.seg = AB{ sPoly.sides[ Left ].back(), sPoly.sides[ Right ].back() };
         endCap.metadata.normal = *sPoly.capNormal_T1;
-        endCap.metadata.t = { 1., 1. };
         endCap.metadata.stroke = stroke;
         endCap.metadata.isCap = true;
-        endCap.metadata.segID = _nextSegID++;
-        // break 'SegID' sequence (for debugging, not necessary)
-        _nextSegID++;
-        addSWD( endCap );
+        endCap.metadata.segID = firstID + static_cast< SegID >( store.size() );
+        store.push_back( endCap );
+        storeCold.push_back( StrokeSegColdMetadata{ { 1., 1. } } );
     }
 }
 
 bool StrokeSegCollider::hitsAnything( const core::model::Polyline& hitter ) const
 {
-    if( hitter.size() < 2 ) {
-        return false;
-    }
+    return anyHitAlongPolyline( hitter, nullptr );
+}
 
-    for( size_t i = 0; i < hitter.size() - 1; i++ ) {
-        std::set< SegID > seenSegs;
-        const AB segHitter{ hitter[ i ], hitter[ i + 1 ] };
-        const auto coordsToCheck = checkCoords( segHitter );
-        for( const auto& coord : coordsToCheck ) {
-            if( _grid.isValidCoord( coord ) ) {
-                const auto& bin = _grid.getRef( coord );
-                for( const auto& swd : bin ) {
-                    if( seenSegs.find( swd.metadata.segID ) != seenSegs.end() ) {
-                        continue;
-                    }
-                    seenSegs.emplace( swd.metadata.segID );
-                    const auto& segSubstroke = swd.seg;
-                    Pos hit;
-                    if( core::mathUtility::segmentsIntersect( segHitter, segSubstroke, hit ) ) {
-                        return true;
-                    }
+bool StrokeSegCollider::hitsAnythingPassing( const core::model::Polyline& hitter,
+                         std::function< bool( const SegWithData& ) > testSWD ) const
+{
+    return anyHitAlongPolyline( hitter, testSWD );
+}
+
+std::vector< StrokeSegCollider::PolylineCandidate > StrokeSegCollider::candidatesAlongPolyline( const Polyline& hitter ) const
+{
+    // Every (stored segment, 'hitter' segment) pair meeting in some cell, then one entry per stored segment.
+    std::vector< std::pair< SegIndex, size_t > > pairs;
+    core::ThreadVisitStamps seenSegs( _segs.size() );
+    for( size_t i = 0; i + 1 < hitter.size(); i++ ) {
+        // A stored segment usually lies in several of the cells along one segment of 'hitter'.
+        seenSegs->startPass( _segs.size() );
+        forEachCellAlong( AB{ hitter[ i ], hitter[ i + 1 ] },
+        [ & ]( const CellView& bin )
+        {
+            for( const auto idx : bin ) {
+                if( live( idx ) && seenSegs->visit( idx ) ) {
+                    pairs.emplace_back( idx, i );
                 }
             }
+            return true;
+        } );
+    }
+    std::sort( pairs.begin(), pairs.end() );
+
+    std::vector< PolylineCandidate > ret;
+    for( const auto& pair : pairs ) {
+        if( ret.empty() || ret.back().idx != pair.first ) {
+            ret.push_back( PolylineCandidate{ pair.first, pair.second, pair.second } );
+        } else {
+            ret.back().last = pair.second;
         }
     }
-    return false;
+    return ret;
 }
 
-bool StrokeSegCollider::hitsAnythingPassing( const core::model::Polyline& hitter,
-                         std::function< bool( const SegWithData& ) > testSWD ) const
+namespace {
+
+/// Return whether 'segmentsIntersect' might report a hit between 'a' and 'b', judging by their
+/// bounding boxes.
+bool boxesOverlap( const AB& a, const AB& b )
 {
-    if( hitter.size() < 2 ) {
-        return false;
+    const auto pad = hitDistTolerance;
+    return std::max( a.a.x(), a.b.x() ) + pad >= std::min( b.a.x(), b.b.x() )
+        && std::max( b.a.x(), b.b.x() ) + pad >= std::min( a.a.x(), a.b.x() )
+        && std::max( a.a.y(), a.b.y() ) + pad >= std::min( b.a.y(), b.b.y() )
+        && std::max( b.a.y(), b.b.y() ) + pad >= std::min( a.a.y(), a.b.y() );
+}
+
+} // unnamed
+
+bool StrokeSegCollider::anyHitAlongPolyline( const core::model::Polyline& hitter, SWDPredicate pred ) const
+{
+    for( const auto& candidate : candidatesAlongPolyline( hitter ) ) {
+        const auto& swd = segWithData( candidate.idx );
+        if( pred && !pred( swd ) ) {
+            continue;
+        }
+        for( auto i = candidate.first; i <= candidate.last; i++ ) {
+            const AB ab{ hitter[ i ], hitter[ i + 1 ] };
+            Pos hitPos;
+            if( boxesOverlap( ab, swd.seg ) && core::mathUtility::segmentsIntersect( ab, swd.seg, hitPos ) ) {
+                return true;
+            }
+        }
     }
+    return _baseLayer && _baseLayer->anyHitAlongPolyline( hitter, basePred( pred ) );
+}
 
-    for( size_t i = 0; i < hitter.size() - 1; i++ ) {
-        std::set< SegID > seenSegs;
-        const AB segHitter{ hitter[ i ], hitter[ i + 1 ] };
-        const auto coordsToCheck = checkCoords( segHitter );
-        for( const auto& coord : coordsToCheck ) {
-            if( _grid.isValidCoord( coord ) ) {
-                const auto& bin = _grid.getRef( coord );
-                for( const auto& swd : bin ) {
-                    if( seenSegs.find( swd.metadata.segID ) != seenSegs.end() ) {
-                        continue;
-                    }
-                    seenSegs.emplace( swd.metadata.segID );
-
-                    if( !testSWD( swd ) ) {
-                        continue;
-                    }
-
-                    const auto& segSubstroke = swd.seg;
-                    Pos hit;
-                    if( core::mathUtility::segmentsIntersect( segHitter, segSubstroke, hit ) ) {
-                        return true;
-                    }
-                }
+boost::optional< StrokeSegCollider::PolylineHit > StrokeSegCollider::firstHitAlongPolyline(
+    const core::model::Polyline& hitter, SWDPredicate pred, bool ignoreFromBehind ) const
+{
+    // The earliest segment of 'hitter' to hit anything wins, and within it the nearest hit.
+    boost::optional< PolylineHit > ret;
+    double retDist = 0.;
+    for( const auto& candidate : candidatesAlongPolyline( hitter ) ) {
+        if( ret && candidate.first > ret->seg ) {
+            continue;
+        }
+        const auto& swd = segWithData( candidate.idx );
+        if( pred && !pred( swd ) ) {
+            continue;
+        }
+        const auto last = ret ? std::min( candidate.last, ret->seg ) : candidate.last;
+        for( auto i = candidate.first; i <= last; i++ ) {
+            const AB ab{ hitter[ i ], hitter[ i + 1 ] };
+            Pos hitPos;
+            if( !boxesOverlap( ab, swd.seg ) || !core::mathUtility::segmentsIntersect( ab, swd.seg, hitPos ) ) {
+                continue;
             }
+            // Ignore backwards hits.
+            if( ignoreFromBehind && Pos::dot( swd.metadata.normal, ab.asVec() ) > 0. ) {
+                continue;
+            }
+
+            const auto distTo = ( hitPos - ab.a ).length();
+            if( !ret || i < ret->seg || distTo < retDist ) {
+                const auto& seg = swd.seg;
+                Hit hit;
+                hit.fHitter = std::clamp( distTo / ab.length(), 0., 1. );
+                hit.swd = swd;
+                hit.strokeT = strokeT( swd.metadata.segID, std::clamp( ( hitPos - seg.a ).length() / seg.length(), 0., 1. ) );
+                hit.pos = hitPos;
+                ret = PolylineHit{ i, hit };
+                retDist = distTo;
+            }
+            // Later segments of 'hitter' cannot do better for this candidate.
+            break;
+        }
+    }
+
+    if( _baseLayer ) {
+        // The base layer only needs to look as far as the hit already found.
+        const auto baseHit = ret
+            ? _baseLayer->firstHitAlongPolyline( core::model::Polyline( hitter.begin(), hitter.begin() + ret->seg + 2 ),
+                                                 basePred( pred ), ignoreFromBehind )
+            : _baseLayer->firstHitAlongPolyline( hitter, basePred( pred ), ignoreFromBehind );
+        if( baseHit && ( !ret || baseHit->seg < ret->seg || ( baseHit->seg == ret->seg && baseHit->hit.fHitter < ret->hit.fHitter ) ) ) {
+            ret = baseHit;
         }
     }
-    return false;
+    return ret;
 }
 
 bool StrokeSegCollider::hitsAnythingPassing( const core::model::Polyline& hitter,
@@ -254,36 +445,36 @@ bool StrokeSegCollider::hitsAnythingPassing( const core::model::Polyline& hitter
         return false;
     }
 
+    core::ThreadVisitStamps seenSegs( _segs.size() );
     for( size_t i = 0; i < hitter.size() - 1; i++ ) {
-        std::set< SegID > seenSegs;
+        seenSegs->startPass( _segs.size() );
         const AB segHitter{ hitter[ i ], hitter[ i + 1 ] };
-        const auto coordsToCheck = checkCoords( segHitter );
-        for( const auto& coord : coordsToCheck ) {
-            if( _grid.isValidCoord( coord ) ) {
-                const auto& bin = _grid.getRef( coord );
-                for( const auto& swd : bin ) {
-                    if( seenSegs.find( swd.metadata.segID ) != seenSegs.end() ) {
-                        continue;
-                    }
-                    seenSegs.emplace( swd.metadata.segID );
-
-                    const auto& segSubstroke = swd.seg;
-                    Pos hit;
-                    if( core::mathUtility::segmentsIntersect( segHitter, segSubstroke, hit ) ) {
-                        const auto f = segSubstroke.t( hit );
-                        const auto tStroke = core::mathUtility::lerp( swd.metadata.t[ 0 ], swd.metadata.t[ 1 ], f );
-                        const auto strokeHandle = swd.metadata.stroke;
-                        if( testStrokeAndT( strokeHandle, tStroke ) ) {
-                            return true;
-                        } else {
-                            continue;
-                        }
-                    }
+        const bool hitNone = forEachCellAlong( segHitter,
+        [ & ]( const CellView& bin )
+        {
+            return forEachCellHit( segHitter, bin, 0,
+            [ & ]( SegIndex idx, const Pos& hit )
+            {
+                if( !seenSegs->visit( idx ) ) {
+                    return true;
                 }
-            }
+                const auto& swd = segWithData( idx );
+                const auto f = swd.seg.t( hit );
+                const auto tStroke = strokeT( swd.metadata.segID, f );
+                const auto strokeHandle = swd.metadata.stroke;
+                return !testStrokeAndT( strokeHandle, tStroke );
+            } );
+        } );
+        if( !hitNone ) {
+            return true;
         }
     }
-    return false;
+
+    return _baseLayer && _baseLayer->hitsAnythingPassing( hitter,
+        [ this, &testStrokeAndT ]( StrokeHandle stroke, double t )
+        {
+            return _baseIncludeStroke( stroke ) && testStrokeAndT( stroke, t );
+        } );
 }
 
 void StrokeSegCollider::sameDrawingHits( DrawingToSameDrawingHits& store, const Drawings& d ) const
@@ -294,172 +485,241 @@ void StrokeSegCollider::sameDrawingHits( DrawingToSameDrawingHits& store, const
         sdh.clear();
     }
 
-    // Prevent checking same segments against each other twice.
-    using SegIDPair = std::array< Metadata::SegID, 2 >;
-    std::set< SegIDPair > seenPairs;
-
-    // Scan all cells
-    _grid.forEveryPos(
-    [ & ]( const CellContents& bin )
+    // A pair of segments can share several cells, but only one cell owns the point where they
+    // hit, so reporting the pair only from that cell reports it once.
+    const auto scanCell = [ & ]( size_t c, DrawingToSameDrawingHits& cellStore )
     {
+        const auto bin = cellAt( c );
         const auto numSegs = bin.size();
         for( size_t i = 0; i < numSegs; i++ ) {
-            const auto& seg_i = bin[ i ].seg;
-            const auto stroke_i = bin[ i ].metadata.stroke;
+            if( !live( bin[ i ] ) ) {
+                continue;
+            }
+            const auto& swd_i = segWithData( bin[ i ] );
+            const auto& seg_i = swd_i.seg;
+            const auto stroke_i = swd_i.metadata.stroke;
             const auto drawing_i = d.whichDrawing( stroke_i );
-            const auto segID_i = bin[ i ].metadata.segID;
+            if( drawing_i == DrawingID::NumDrawings ) {
+                continue;
+            }
 
-            for( size_t j = i + 1; j < numSegs; j++ ) {
-                const auto& seg_j = bin[ j ].seg;
-                const auto stroke_j = bin[ j ].metadata.stroke;
+            // Test 'seg_i' against the rest of the cell in blocks, then sift through the hits.
+            forEachCellHit( seg_i, bin, i + 1,
+            [ & ]( SegIndex idx_j, const Pos& hit )
+            {
+                const auto& swd_j = segWithData( idx_j );
+                const auto& seg_j = swd_j.seg;
+                const auto stroke_j = swd_j.metadata.stroke;
                 const auto drawing_j = d.whichDrawing( stroke_j );
-                const auto segID_j = bin[ j ].metadata.segID;
-                
-                if( drawing_i != drawing_j || drawing_i == DrawingID::NumDrawings ) {
-                    continue;
-                }
 
-                // Prevent unnecessary work
-                const SegIDPair pair{ segID_i, segID_j };
-                if( seenPairs.find( pair ) != seenPairs.end() ) {
-                    continue;
+                if( drawing_i != drawing_j || !cellOwns( c, hit ) ) {
+                    return true;
                 }
-                seenPairs.emplace( pair );
-
-                core::model::Pos hit;
-                if( core::mathUtility::segmentsIntersect( seg_i, seg_j, hit ) ) {
-                    const auto& tRange_strokeI = bin[ i ].metadata.t;
-                    const auto& tRange_strokeJ = bin[ j ].metadata.t;
-                    const auto t_strokeI = core::mathUtility::lerp(
-                        tRange_strokeI[ 0 ],
-                        tRange_strokeI[ 1 ],
-                        seg_i.t( hit ) );
-                    const auto t_strokeJ = core::mathUtility::lerp(
-                        tRange_strokeJ[ 0 ],
-                        tRange_strokeJ[ 1 ],
-                        seg_j.t( hit ) );
-
-                    // If this is a same-stroke intersection, there is a risk that we're actually
-                    // detecting a cusp in one of the stroke's sides. Crude way to reduce these
-                    // false positives is to require a
-                    const auto minTGapForSameStroke = 0.1;
-
-                    if( stroke_i != stroke_j || std::abs( t_strokeI - t_strokeJ ) >= minTGapForSameStroke ) {
-                        store[ drawing_i ].addHit( stroke_i, stroke_j, t_strokeI, t_strokeJ );
-                    }
+
+                const auto t_strokeI = strokeT( swd_i.metadata.segID, seg_i.t( hit ) );
+                const auto t_strokeJ = strokeT( swd_j.metadata.segID, seg_j.t( hit ) );
+
+                // If this is a same-stroke intersection, there is a risk that we're actually
+                // detecting a cusp in one of the stroke's sides. Crude way to reduce these
+                // false positives is to require a
+                const auto minTGapForSameStroke = 0.1;
+
+                if( stroke_i != stroke_j || std::abs( t_strokeI - t_strokeJ ) >= minTGapForSameStroke ) {
+                    cellStore[ drawing_i ].addHit( stroke_i, stroke_j, t_strokeI, t_strokeJ );
                 }
-            }
+                return true;
+            } );
+        }
+    };
+
+    // Scan all cells, a chunk of them per task, each task into its own buffer.
+    const auto numChunks = core::numWorkerThreads() * 4;
+    std::vector< DrawingToSameDrawingHits > chunkStores( numChunks );
+    core::parallelForChunks( numCells(), numChunks,
+    [ & ]( size_t chunk, size_t begin, size_t end )
+    {
+        for( auto c = begin; c < end; c++ ) {
+            scanCell( c, chunkStores[ chunk ] );
         }
     } );
+    for( const auto& chunkStore : chunkStores ) {
+        for( int dID = 0; dID < DrawingID::NumDrawings; dID++ ) {
+            store[ dID ].addHits( chunkStore[ dID ] );
+        }
+    }
+}
+
+void StrokeSegCollider::addSameDrawingHits( StrokeHandle s, DrawingToSameDrawingHits& store, const Drawings& d ) const
+{
+    const auto it = _strokeToSegs.find( s );
+    const auto drawing_s = d.whichDrawing( s );
+    if( it == _strokeToSegs.end() || drawing_s == DrawingID::NumDrawings ) {
+        return;
+    }
+
+    // A segment can be in several of the cells that another passes through.
+    core::ThreadVisitStamps seenSegs( _segs.size() );
+    for( const auto idx_i : it->second ) {
+        const auto& swd_i = segWithData( idx_i );
+        const auto& seg_i = swd_i.seg;
+        seenSegs->startPass( _segs.size() );
+        forEachCellAlong( seg_i,
+        [ & ]( const CellView& bin )
+        {
+            return forEachCellHit( seg_i, bin, 0,
+            [ & ]( SegIndex idx_j, const Pos& hit )
+            {
+                if( idx_j == idx_i || !seenSegs->visit( idx_j ) ) {
+                    return true;
+                }
+                const auto& swd_j = segWithData( idx_j );
+                const auto& seg_j = swd_j.seg;
+                const auto stroke_j = swd_j.metadata.stroke;
+                // Meet each pair of 's''s own segments only once.
+                if( ( stroke_j == s && idx_j < idx_i ) || d.whichDrawing( stroke_j ) != drawing_s ) {
+                    return true;
+                }
+
+                const auto t_strokeI = strokeT( swd_i.metadata.segID, seg_i.t( hit ) );
+                const auto t_strokeJ = strokeT( swd_j.metadata.segID, seg_j.t( hit ) );
+
+                // As in 'sameDrawingHits'.
+                const auto minTGapForSameStroke = 0.1;
+
+                if( stroke_j != s || std::abs( t_strokeI - t_strokeJ ) >= minTGapForSameStroke ) {
+                    store[ drawing_s ].addHit( s, stroke_j, t_strokeI, t_strokeJ );
+                }
+                return true;
+            } );
+        } );
+    }
 }
 
 boost::optional< Hit > StrokeSegCollider::firstHit( const AB& ab, SWDPredicate pred, bool ignoreFromBehind ) const
 {
-    const auto coordsToCheck = checkCoords( ab );
+    core::ThreadVisitStamps seenSegs( _segs.size() );
+    auto ret = firstHit( ab,
+    [ & ]( SegIndex idx )
+    {
+        return !pred || pred( segWithData( idx ) );
+    }, ignoreFromBehind, *seenSegs );
 
+    if( _baseLayer ) {
+        const auto baseHit = _baseLayer->firstHit( ab, basePred( pred ), ignoreFromBehind );
+        if( baseHit && ( !ret || baseHit->fHitter < ret->fHitter ) ) {
+            ret = baseHit;
+        }
+    }
+    return ret;
+}
+
+boost::optional< Hit > StrokeSegCollider::firstHit( const AB& ab, const std::function< bool( SegIndex ) >& passes,
+                                                    bool ignoreFromBehind, core::VisitStamps& seenSegs ) const
+{
     double shortestDist = std::numeric_limits< double >::max();
     boost::optional< Hit > ret;
 
     const auto abLength = ab.length();
 
-    std::set< SegID > seenSegs;
-
-    for( const auto& coord : coordsToCheck ) {
-        if( _grid.isValidCoord( coord ) ) {
-            const auto& bin = _grid.getRef( coord );
-            for( const auto& swd : bin ) {
-                if( seenSegs.find( swd.metadata.segID ) == seenSegs.cend() ) {
-                    seenSegs.emplace( swd.metadata.segID );
-                } else {
-                    continue;
-                }
-
-                // Filter by 'pred'.
-                if( pred && !pred( swd ) ) {
-                    continue;
-                }
+    // Visit cells in order along 'ab'. A hit is found no later than in the cell where 'ab' reaches
+    // it, so once the next cell starts beyond the best hit so far, nothing closer remains.
+    forEachCellAlongInOrder( ab,
+    [ & ]( const CellView& bin, double fEnter )
+    {
+        if( fEnter * abLength > shortestDist + hitDistTolerance ) {
+            return false;
+        }
+        forEachCellHit( ab, bin, 0,
+        [ & ]( SegIndex idx, const Pos& hitPos )
+        {
+            if( !seenSegs.visit( idx ) ) {
+                return true;
+            }
+            if( !passes( idx ) ) {
+                return true;
+            }
+            const auto& swd = segWithData( idx );
 
-                // Ignore backwards hits.
-                if( ignoreFromBehind ) {
-                    const auto& barrNorm = swd.metadata.normal;
-                    if( Pos::dot( barrNorm, ab.asVec() ) > 0. ) {
-                        continue;
-                    }
+            // Ignore backwards hits.
+            if( ignoreFromBehind ) {
+                const auto& barrNorm = swd.metadata.normal;
+                if( Pos::dot( barrNorm, ab.asVec() ) > 0. ) {
+                    return true;
                 }
+            }
 
-                const auto& seg = swd.seg;
-                Pos hitPos;
-                if( core::mathUtility::segmentsIntersect( ab, seg, hitPos ) ) {
-                    const auto distTo = ( hitPos - ab.a ).length();
-                    if( distTo < shortestDist ) {
-                        shortestDist = distTo;
-                        const auto f_ab = std::clamp( distTo / abLength, 0., 1. );
-                        const auto f_seg = std::clamp( ( hitPos - seg.a ).length() / seg.length(), 0., 1. );
-                        Hit hit;
-                        hit.fHitter = f_ab;
-                        hit.swd = swd;
-                        hit.strokeT = core::mathUtility::lerp( swd.metadata.t[ 0 ], swd.metadata.t[ 1 ], f_seg );
-                        hit.pos = hitPos;
-                        ret = hit;
-                    }
-                }
+            const auto& seg = swd.seg;
+            const auto distTo = ( hitPos - ab.a ).length();
+            if( distTo < shortestDist ) {
+                shortestDist = distTo;
+                const auto f_ab = std::clamp( distTo / abLength, 0., 1. );
+                const auto f_seg = std::clamp( ( hitPos - seg.a ).length() / seg.length(), 0., 1. );
+                Hit hit;
+                hit.fHitter = f_ab;
+                hit.swd = swd;
+                hit.strokeT = strokeT( swd.metadata.segID, f_seg );
+                hit.pos = hitPos;
+                ret = hit;
             }
-        }
-    }
+            return true;
+        } );
+        return true;
+    } );
 
     return ret;
 }
 
 std::vector< Hit > StrokeSegCollider::allHits( const AB& ab, SWDPredicate pred, bool ignoreFromBehind ) const
 {
-    const auto coordsToCheck = checkCoords( ab );
-
     std::vector< Hit > ret;
 
     const auto abLength = ab.length();
 
-    std::set< SegID > seenSegs;
-
-    for( const auto& coord : coordsToCheck ) {
-        if( _grid.isValidCoord( coord ) ) {
-            const auto& bin = _grid.getRef( coord );
-            for( const auto& swd : bin ) {
-                if( seenSegs.find( swd.metadata.segID ) == seenSegs.cend() ) {
-                    seenSegs.emplace( swd.metadata.segID );
-                } else {
-                    continue;
-                }
+    core::ThreadVisitStamps seenSegs( _segs.size() );
 
-                // Filter by 'pred'.
-                if( pred && !pred( swd ) ) {
-                    continue;
-                }
+    forEachCellAlong( ab,
+    [ & ]( const CellView& bin )
+    {
+        forEachCellHit( ab, bin, 0,
+        [ & ]( SegIndex idx, const Pos& hitPos )
+        {
+            if( !seenSegs->visit( idx ) ) {
+                return true;
+            }
+            const auto& swd = segWithData( idx );
 
-                // Ignore backwards hits.
-                if( ignoreFromBehind ) {
-                    const auto& barrNorm = swd.metadata.normal;
-                    if( Pos::dot( barrNorm, ab.asVec() ) > 0. ) {
-                        continue;
-                    }
-                }
+            // Filter by 'pred'.
+            if( pred && !pred( swd ) ) {
+                return true;
+            }
 
-                const auto& seg = swd.seg;
-                Pos hitPos;
-                if( core::mathUtility::segmentsIntersect( ab, seg, hitPos ) ) {
-                    const auto distTo = ( hitPos - ab.a ).length();
-                    const auto f_ab = std::clamp( distTo / abLength, 0., 1. );
-                    const auto f_seg = std::clamp( ( hitPos - seg.a ).length() / seg.length(), 0., 1. );
-                    Hit hit;
-                    hit.fHitter = f_ab;
-                    hit.swd = swd;
-                    hit.strokeT = core::mathUtility::lerp( swd.metadata.t[ 0 ], swd.metadata.t[ 1 ], f_seg );
-                    hit.pos = hitPos;
-                    ret.push_back( hit );
+            // Ignore backwards hits.
+            if( ignoreFromBehind ) {
+                const auto& barrNorm = swd.metadata.normal;
+                if( Pos::dot( barrNorm, ab.asVec() ) > 0. ) {
+                    return true;
                 }
             }
-        }
-    }
 
+            const auto& seg = swd.seg;
+            const auto distTo = ( hitPos - ab.a ).length();
+            const auto f_ab = std::clamp( distTo / abLength, 0., 1. );
+            const auto f_seg = std::clamp( ( hitPos - seg.a ).length() / seg.length(), 0., 1. );
+            Hit hit;
+            hit.fHitter = f_ab;
+            hit.swd = swd;
+            hit.strokeT = strokeT( swd.metadata.segID, f_seg );
+            hit.pos = hitPos;
+            ret.push_back( hit );
+            return true;
+        } );
+        return true;
+    } );
+
+    if( _baseLayer ) {
+        const auto baseHits = _baseLayer->allHits( ab, basePred( pred ), ignoreFromBehind );
+        ret.insert( ret.end(), baseHits.begin(), baseHits.end() );
+    }
     return ret;
 }
 
@@ -545,13 +805,14 @@ OnBarrierPath StrokeSegCollider::onBarrierPath( const Hit& start, bool goWithBar
         // Find out if we're interrupted by anything while moving from 'prevBarrierPos'
         // to 'nextBarrierPos' along segment 'nextSegID'. Use 'hitsAllowed' to filter
         // out interruptions that we want to ignore.
+        const auto& curCold = coldMetadata( curSegID );
         const auto hitsAllowed = [ & ]( const SegWithData& swd )
         {
             // Ignore segments that are adjacent to 'curSegID' on the
             // same 'Stroke'-side.
             const auto encounteredID = swd.metadata.segID;
-            if( curSWD.metadata.next == encounteredID ||
-                curSWD.metadata.prev == encounteredID ) {
+            if( curCold.next == encounteredID ||
+                curCold.prev == encounteredID ) {
                 return false;
             }
 
@@ -608,22 +869,19 @@ OnBarrierPath StrokeSegCollider::onBarrierPath( const Hit& start, bool goWithBar
         } else {
             // Can we move to next segment on side of whatever 'Stroke'?                        
             const auto nextSegID_tentative = goWithBarr
-                                                 ? curSWD.metadata.next
-                                                 : curSWD.metadata.prev;
-            const auto it = nextSegID_tentative
-                ? _idToSWD.find( *nextSegID_tentative )
-                : _idToSWD.end();
-            if( it == _idToSWD.end() ) {
+                                                 ? curCold.next
+                                                 : curCold.prev;
+            if( nextSegID_tentative == Metadata::noSegID ) {
                 // We've run all the way to the end of this side of 'Stroke'. This is the end.
-            } else if( seenSegs.find( *nextSegID_tentative ) != seenSegs.end() ) {
-                if( *nextSegID_tentative == start.swd.metadata.segID ) {
+            } else if( seenSegs.find( nextSegID_tentative ) != seenSegs.end() ) {
+                if( nextSegID_tentative == start.swd.metadata.segID ) {
                     // Our path is a loop.
                     ret.closed = true;
                 } // else probable something went wrong but don't throw ...
             } else {
-                nextSegID = *nextSegID_tentative;
+                nextSegID = nextSegID_tentative;
                 seenSegs.emplace( *nextSegID );
-                nextSWD = &it->second;
+                nextSWD = &segWithID( *nextSegID );
             }
         }
 
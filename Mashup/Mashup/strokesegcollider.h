@@ -8,9 +8,14 @@
 #include <Core/model/lineforward.h>
 #include <Core/model/polyline.h>
 #include <Core/math/segcollidergrid.h>
+#include <Core/math/segindextype.h>
+#include <Core/utility/visitstamps.h>
 
 #include <boost/optional.hpp>
 
+#include <array>
+#include <cstdint>
+#include <limits>
 #include <map>
 
 namespace mashup {
@@ -20,13 +25,17 @@ struct OnBarrierPath;
 struct StrokePoly;
 struct Substroke;
 
+/// What the collider's queries look at for every candidate segment. Whatever is only needed once
+/// a segment has been hit lives in 'StrokeSegColdMetadata' instead, to keep this small.
 struct StrokeSegColliderMetadata
 {
-    using SegID = int;
+    /// Index of the segment in its collider's segment pool, offset (in a layered collider) past
+    /// every 'SegID' of the base layer.
+    using SegID = std::uint32_t;
+    /// Stands for "no segment".
+    static constexpr SegID noSegID = std::numeric_limits< SegID >::max();
 
     StrokeHandle stroke = nullptr;
-    /// A segment in the collider represents 't' along 'stroke'.
-    std::array< double, 2 > t = { 0., 0. };
     /// Of the 'Stroke' outline that this segment is a part of.
     core::model::Pos normal;
     /// Can be checked on its own for 'this' equality.
@@ -34,19 +43,46 @@ struct StrokeSegColliderMetadata
 
     /// Is this segment the cap of 'stroke', not part of one of its sides.
     bool isCap = false;
+};
+static_assert( sizeof( StrokeSegColliderMetadata ) <= 32, "StrokeSegColliderMetadata no longer fits in half a cache line." );
+
+/// The rest of a collider segment's description, looked up by 'SegID'.
+struct StrokeSegColdMetadata
+{
+    using SegID = StrokeSegColliderMetadata::SegID;
 
-    /// These define a sequence of segments representing one side of 'stroke'.
-    boost::optional< SegID > next;
-    boost::optional< SegID > prev;
+    /// A segment in the collider represents 't' along 'stroke'.
+    std::array< double, 2 > t = { 0., 0. };
+
+    /// These define a sequence of segments representing one side of 'stroke' ('noSegID' at its ends).
+    SegID next = StrokeSegColliderMetadata::noSegID;
+    SegID prev = StrokeSegColliderMetadata::noSegID;
 };
 
 /// A spatial structure for rapidly finding out whether a line segment interects any of a collection
 /// of line segments taken from 'Stroke's that are participating in a blend-drawings operation.
-class StrokeSegCollider : public core::math::SegColliderGrid< StrokeSegColliderMetadata >
+///
+/// A collider can be layered over a read-only base collider, in which case its queries report
+/// hits on both its own segments and (some of) the base's, without re-indexing the latter. The
+/// grid is a private base so that only queries aware of both layers can be reached.
+class StrokeSegCollider : private core::math::SegColliderGrid< StrokeSegColliderMetadata >
 {
 public:
     using Base = core::math::SegColliderGrid< StrokeSegColliderMetadata >;
     using Metadata = StrokeSegColliderMetadata;
+    using Pos = Base::Pos;
+    using IPos = Base::IPos;
+    using SegWithData = Base::SegWithData;
+    using SegsWithData = Base::SegsWithData;
+    using MetadataPredicate = Base::MetadataPredicate;
+    using SWDPredicate = Base::SWDPredicate;
+
+    // The grid's layout, which both layers share.
+    using Base::bounds;
+    using Base::gridParams;
+    using GridParams = Base::GridParams;
+    using Base::indexType;
+    using Base::setCellWidth;
 
     /// Collision between some directed 1D object (segment or ray) and
     /// a registered segment.
@@ -60,9 +96,33 @@ public:
         core::model::Pos pos;
     };
 
-    StrokeSegCollider( const core::model::BoundingBox& canvasBounds );
+    /// A 'Hit' by one segment of a polyline.
+    struct PolylineHit
+    {
+        /// The segment from point 'seg' to point 'seg + 1' of the polyline made the hit
+        /// ('hit.fHitter' is relative to that segment).
+        size_t seg = 0;
+        Hit hit;
+    };
+
+    StrokeSegCollider( const core::model::BoundingBox& canvasBounds,
+                       core::math::SegIndexType indexType = core::math::UniformGrid );
+    /// Make an empty collider layered over those segments of 'base' whose 'Stroke's pass
+    /// 'includeStroke'. 'base' (which cannot itself be layered) must outlive 'this' and must not
+    /// change in the meantime. Only 'this''s own 'Stroke's can be added and removed.
+    StrokeSegCollider( const StrokeSegCollider& base, std::function< bool( StrokeHandle ) > includeStroke );
+
+    /// From now on, have 'bulkLoad' (uniform grid only) size the cells to suit the segments it
+    /// loads (see 'SegColliderGrid::tunedCellWidth'), using at most 'maxCells' cells.
+    void autoTuneCells( size_t maxCells );
+    /// Return the cell layout 'bulkLoad' chose, if it has auto-tuned the cells.
+    boost::optional< GridParams > tunedGridParams() const;
 
     void addStroke( const StrokePoly& );
+    /// Replace the contents of 'this' with 'sPolys', using the compact read-optimized layout
+    /// (see 'SegColliderGrid::bulkLoad'). Prefer this over repeated 'addStroke' calls when
+    /// the contents are known up front.
+    void bulkLoad( const std::vector< const StrokePoly* >& sPolys );
     /// Remove any segments associated w/ this 'Stroke'.
     void removeStroke( StrokeHandle );
 
@@ -73,6 +133,16 @@ public:
     bool hitsAnythingPassing( const core::model::Polyline& hitter,
                               std::function< bool( const SegWithData& ) > testSWD ) const;
     bool hitsAnything( const core::model::Polyline& hitter ) const;
+
+    /// Return the first collision (by arc length) along 'hitter' with something satisfying 'pred';
+    /// the same as calling 'firstHit' on each segment of 'hitter' in turn until one hits, but the cells
+    /// along 'hitter' are walked once, and each stored segment found there is tested (and passed to
+    /// 'pred') once, against only those segments of 'hitter' whose cells hold it.
+    boost::optional< PolylineHit > firstHitAlongPolyline( const core::model::Polyline& hitter,
+                                                          SWDPredicate pred, bool ignoreFromBehind ) const;
+    /// Return whether any segment of 'hitter' hits anything satisfying 'pred' (ignore 'pred' if null).
+    /// Works like 'firstHitAlongPolyline'.
+    bool anyHitAlongPolyline( const core::model::Polyline& hitter, SWDPredicate pred ) const;
     
     /// Return the first collision along 'hitter' with something satisfying 'pred' (if any; return boost::none
     /// if there is no first collision). If 'ignoreFromBehind' is true, ignore collisions with back-facing
@@ -96,20 +166,159 @@ public:
     /// be equal in that case).
     OnBarrierPath onBarrierPath( const Hit& start, bool goWithBarr ) const;
 
+    /// See 'SegColliderGrid::distToNearestSeg'; includes the base layer.
+    boost::optional< double > distToNearestSeg( const Pos& posCanvas, MetadataPredicate segsToConsider, double maxDistAllowed ) const;
+    /// See 'SegColliderGrid::distsToNearestSeg'; includes the base layer.
+    std::vector< boost::optional< double > > distsToNearestSeg( const std::vector< Pos >& positions, MetadataPredicate segsToConsider,
+                                                                const std::vector< double >& maxDistsAllowed ) const;
+
+    /// Return the segment (of either layer) that has 'id'.
+    const SegWithData& segWithID( StrokeSegColliderMetadata::SegID id ) const;
+    const StrokeSegColdMetadata& coldMetadata( StrokeSegColliderMetadata::SegID id ) const;
+
+    /// Call 'f( swd )' once for each segment (of either layer) in a neighborhood of cells guaranteed
+    /// to include everything within 'range' of 'posCanvas' (or of any point in cell 'xy'), stopping if
+    /// 'f' returns false. Return false iff stopped. 'swd' refers to the stored segment itself.
+    template< typename F >
+    bool forEachStrokeSegWithinRange( const Pos& posCanvas, double range, F&& f ) const;
+    template< typename F >
+    bool forEachStrokeSegWithinRange( const IPos& xy, double range, F&& f ) const;
+
+    /// Call 'f( swd, hitPos )' once for each segment (of either layer) that 'hitter' intersects (at
+    /// 'hitPos', exactly as 'segmentsIntersect( hitter, swd.seg, hitPos )' would report it), in no
+    /// particular order, stopping if 'f' returns false. Return false iff stopped. Only the cells that
+    /// 'hitter' passes through are visited.
+    template< typename F >
+    bool forEachStrokeSegHit( const core::model::Seg& hitter, F&& f ) const;
+
+    /// Return copies of the segments that 'forEachStrokeSegWithinRange' visits.
     std::vector< SegWithData > strokeSegsWithinRange( const Pos& posCanvas, double range ) const;
     std::vector< SegWithData > strokeSegsWithinRange( const IPos&, double range ) const;
 
     /// Fill 'store' with information about original-drawing 'Stroke's hitting each other.
-    /// 'd' tells 'this' which 'Stroke'-segments belong to which 'Drawing's.
+    /// 'd' tells 'this' which 'Stroke'-segments belong to which 'Drawing's. Ignores any base layer.
     void sameDrawingHits( DrawingToSameDrawingHits& store, const Drawings& d ) const;
+    /// Add to 'store' those of the hits that 'sameDrawingHits' finds that involve 's'.
+    void addSameDrawingHits( StrokeHandle s, DrawingToSameDrawingHits& store, const Drawings& d ) const;
 private:
-    StrokeSegColliderMetadata::SegID _nextSegID;
-    // this is just to make removeStroke faster
-    /// Track which array coordinates are involved in representing each 'Stroke'.
-    std::map< StrokeHandle, SetOfIPos > _strokeToInvolvedCoords;
-    std::map< StrokeSegColliderMetadata::SegID, SegWithData > _idToSWD;
+    /// A stored segment lying in cells that segments 'first' through 'last' of some polyline pass through.
+    struct PolylineCandidate
+    {
+        SegIndex idx = 0;
+        size_t first = 0;
+        size_t last = 0;
+    };
+    /// Return (once each, by increasing 'idx') the live segments in the cells that 'hitter' passes through.
+    std::vector< PolylineCandidate > candidatesAlongPolyline( const core::model::Polyline& hitter ) const;
+
+    /// 'firstHit', where 'passes( idx )' stands in for 'pred' and 'seenSegs' must have been started on a
+    /// new pass.
+    boost::optional< Hit > firstHit( const core::model::Seg& hitter, const std::function< bool( SegIndex ) >& passes,
+                                     bool ignoreFromBehind, core::VisitStamps& seenSegs ) const;
+
+    /// Append to 'store' the segments representing 'sPoly' (nothing if it doesn't participate),
+    /// giving the one landing at 'store[ i ]' the 'SegID' 'firstID + i', and append their
+    /// 'StrokeSegColdMetadata' to 'storeCold' (which must be parallel to 'store').
+    void strokeSegs( const StrokePoly& sPoly, StrokeSegColliderMetadata::SegID firstID, SegsWithData& store,
+                     std::vector< StrokeSegColdMetadata >& storeCold );
+
+    /// Drop removed segments from the pool (see 'SegColliderGrid::compactPool'), renumbering the
+    /// 'SegID's of the rest.
+    void compactPool();
+
+    /// Return the linear interpolation of 'id''s T range at 'f'.
+    double strokeT( StrokeSegColliderMetadata::SegID id, double f ) const;
+
+    /// Return 'pred' restricted to the base layer's included segments.
+    SWDPredicate basePred( SWDPredicate pred ) const;
+    /// Return 'segsToConsider' restricted to the base layer's included segments.
+    MetadataPredicate baseMetadataPred( MetadataPredicate segsToConsider ) const;
+
+    /// If non-null, the read-only layer under 'this'.
+    const StrokeSegCollider* _baseLayer = nullptr;
+    std::function< bool( StrokeHandle ) > _baseIncludeStroke;
+    /// Indexed by the base's 'SegID's: whether 'this' includes the segment.
+    std::vector< bool > _baseIncluded;
+    /// The 'SegID' of '_segs[ 0 ]'.
+    StrokeSegColliderMetadata::SegID _firstOwnID = 0;
+
+    /// If nonzero, 'bulkLoad' auto-tunes the cells, using at most this many.
+    size_t _autoTuneMaxCells = 0;
+    boost::optional< GridParams > _tunedGrid;
+
+    /// Parallel to '_segs'.
+    std::vector< StrokeSegColdMetadata > _cold;
+
+    /// The 'SegIndex'es of the segments representing each 'Stroke', so that 'removeStroke' costs
+    /// time in proportion to the 'Stroke''s own segments.
+    std::map< StrokeHandle, SegIndices > _strokeToSegs;
 };
 
+template< typename F >
+bool StrokeSegCollider::forEachStrokeSegWithinRange( const Pos& posCanvas, double range, F&& f ) const
+{
+    return forEachStrokeSegWithinRange( cellCoords( posCanvas ), range, f );
+}
+
+template< typename F >
+bool StrokeSegCollider::forEachStrokeSegWithinRange( const IPos& xy, double range, F&& f ) const
+{
+    if( _baseLayer ) {
+        // Type-erase the wrapper so that recursing through base layers instantiates nothing new.
+        const bool finished = _baseLayer->forEachStrokeSegWithinRange( xy, range,
+        std::function< bool( const SegWithData& ) >( [ & ]( const SegWithData& swd )
+        {
+            return !_baseIncluded[ swd.metadata.segID ] || f( swd );
+        } ) );
+        if( !finished ) {
+            return false;
+        }
+    }
+
+    // A segment can be in several of the cells.
+    core::ThreadVisitStamps seenSegs( _segs.size() );
+    bool stopped = false;
+    forEachCellNear( xy, range,
+    [ & ]( const CellView& bin )
+    {
+        for( size_t i = 0; i < bin.size() && !stopped; i++ ) {
+            const auto idx = bin[ i ];
+            if( live( idx ) && seenSegs->visit( idx ) ) {
+                stopped = !f( segWithData( idx ) );
+            }
+        }
+    } );
+    return !stopped;
+}
+
+template< typename F >
+bool StrokeSegCollider::forEachStrokeSegHit( const core::model::Seg& hitter, F&& f ) const
+{
+    if( _baseLayer ) {
+        // Type-erase the wrapper so that recursing through base layers instantiates nothing new.
+        const bool finished = _baseLayer->forEachStrokeSegHit( hitter,
+        std::function< bool( const SegWithData&, const Pos& ) >( [ & ]( const SegWithData& swd, const Pos& hitPos )
+        {
+            return !_baseIncluded[ swd.metadata.segID ] || f( swd, hitPos );
+        } ) );
+        if( !finished ) {
+            return false;
+        }
+    }
+
+    // A segment can be in several of the cells.
+    core::ThreadVisitStamps seenSegs( _segs.size() );
+    return forEachCellAlong( hitter,
+    [ & ]( const CellView& bin )
+    {
+        return forEachCellHit( hitter, bin, 0,
+        [ & ]( SegIndex idx, const Pos& hitPos )
+        {
+            return !seenSegs->visit( idx ) || f( segWithData( idx ), hitPos );
+        } );
+    } );
+}
+
 } // mashup
 
 #endif // #include
@@ -435,17 +435,11 @@ UniqueCurve TailData::limitByCollider( const Curve& toLimit, const Coll& coll )
     }
 
     boost::optional< double > endT;
-    for( size_t i = 0; i < numSamples - 1; i++ ) {
-        const auto& pA = sampleP[ i ];
-        const auto& pB = sampleP[ i + 1 ];
-        const Seg pSeg{ pA, pB };
-        const auto hit = coll.firstHit( pSeg, nullptr, true );
-        if( hit ) {
-            const auto tA = sampleT[ i ];
-            const auto tB = sampleT[ i + 1 ];
-            endT = core::mathUtility::lerp( tA, tB, hit->fHitter );
-            break;
-        }
+    const auto hit = coll.firstHitAlongPolyline( sampleP, nullptr, true );
+    if( hit ) {
+        const auto tA = sampleT[ hit->seg ];
+        const auto tB = sampleT[ hit->seg + 1 ];
+        endT = core::mathUtility::lerp( tA, tB, hit->hit.fHitter );
     }
 
     if( endT ) {
@@ -735,21 +735,28 @@ struct TailMaker::Imp
                 static_cast< size_t >( ( len / coll.bounds().avgDim() ) * 40. ),
                 curveParts.size() * 3 );
         }
-        Polyline wControl( numWSamples );
+        // Ask 'coll' about all the samples at once.
+        std::vector< double > widths_stroke( numWSamples );
+        std::vector< Pos > samplePositions( numWSamples );
+        std::vector< double > maxDists( numWSamples );
         for( size_t i = 0; i < numWSamples; i++ ) {
             const auto tPosCurve = F_FROM_I( i, numWSamples );
             const auto tStroke = core::mathUtility::lerp( tStrokeStart, tStrokeEnd, tPosCurve );
+            widths_stroke[ i ] = stroke.width( tStroke );
+            samplePositions[ i ] = posCurve->position( tPosCurve );
+            // The *2 and /2 reflect switching between stroke width and stroke "radius".
+            maxDists[ i ] = ( widths_stroke[ i ] * 0.5 ) / opts.tails.maxWidthFillAllowed_f;
+        }
+        const auto collDists = coll.distsToNearestSeg( samplePositions, nullptr, maxDists );
+
+        Polyline wControl( numWSamples );
+        for( size_t i = 0; i < numWSamples; i++ ) {
+            const auto tPosCurve = F_FROM_I( i, numWSamples );
 
-            const auto width_stroke = stroke.width( tStroke );
+            const auto width_stroke = widths_stroke[ i ];
             double width_maxAllowedByColl = width_stroke;
-            {
-                // The *2 and /2 reflect switching between stroke width and stroke "radius".
-                const auto pos = posCurve->position( tPosCurve );
-                const auto res = coll.distToNearestSeg(
-                    pos, nullptr, ( width_stroke * 0.5 ) / opts.tails.maxWidthFillAllowed_f );
-                if( res ) {
-                    width_maxAllowedByColl = 2. * ( res.value() * opts.tails.maxWidthFillAllowed_f );
-                }
+            if( collDists[ i ] ) {
+                width_maxAllowedByColl = 2. * ( collDists[ i ].value() * opts.tails.maxWidthFillAllowed_f );
             }
 
             const auto fTaper = overallTaperFromF->yFromF( tPosCurve );
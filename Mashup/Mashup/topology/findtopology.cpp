@@ -3,18 +3,24 @@
 #include <drawingid.h>
 #include <strokeback.h>
 #include <strokepoly.h>
+#include <strokepolyindex.h>
+#include <strokesegcollider.h>
 #include <topology/strokeintersection.h>
 #include <topology/strokeintervals.h>
 #include <topology/topology.h>
 
+#include <Core/exceptions/runtimeerror.h>
 #include <Core/model/polyline.h>
 #include <Core/model/lineback.h>
+#include <Core/math/polygonunion.h>
 
 #include <Core/utility/mathutility.h>
+#include <Core/utility/parallelfor.h>
 
 #include <algorithm>
-#include <map>
 #include <set>
+#include <tuple>
+#include <unordered_map>
 
 namespace mashup {
 namespace topology {
@@ -25,8 +31,12 @@ using Seg = core::model::Seg;
 
 struct FindTopology::Imp
 {
-    Imp( const Drawing& a, const Drawing& b, const StrokeToPoly& sToPoly )
+    Imp( const Drawing& a, const Drawing& b, const StrokeToPoly& sToPoly, const StrokeSegCollider& coll,
+         OcclusionEngine engine )
         : drawings{ &a, &b }
+        , sToPoly( sToPoly )
+        , coll( coll )
+        , engine( engine )
     {
         const auto ingest = [ & ]( DrawingID dId, const Drawing& d )
         {
@@ -34,12 +44,91 @@ struct FindTopology::Imp
             size_t i = 0;
             d.forEach( [ & ]( const Stroke& s )
             {
+                strokeToIndex[ dId ][ &s ] = i;
                 polys[ dId ][ i++ ] = &( sToPoly.find( &s )->second );
             } );
+            polyIndex[ dId ] = std::make_unique< StrokePolyIndex >( polys[ dId ] );
         };
         
         ingest( DrawingID::DrawingA, a );
         ingest( DrawingID::DrawingB, b );
+
+        if( engine == OutlineUnion ) {
+            for( int dId = 0; dId < DrawingID::NumDrawings; dId++ ) {
+                buildOutlineUnion( static_cast< DrawingID >( dId ) );
+            }
+        }
+    }
+
+    void buildOutlineUnion( DrawingID dId )
+    {
+        // Snap to a grid far finer than any 'StrokePoly' detail.
+        const double scale = 1e7 / std::max( coll.bounds().maxDim(), 1. );
+        outlineUnions[ dId ] = std::make_unique< core::math::PolygonUnion >( scale );
+        for( size_t i = 0; i < polys[ dId ].size(); i++ ) {
+            outlineUnions[ dId ]->setGroup( i, outlineQuads( *polys[ dId ][ i ] ) );
+        }
+    }
+
+    /// Return the quads that make up the outline of 'poly' (the region its 'contains' covers), if it participates.
+    static core::model::Polylines outlineQuads( const StrokePoly& poly )
+    {
+        core::model::Polylines ret;
+        if( !poly.participates() ) {
+            return ret;
+        }
+        const auto& left = poly.sides[ Left ];
+        const auto& right = poly.sides[ Right ];
+        for( size_t i = 0; i + 1 < poly.pointsPerSide(); i++ ) {
+            ret.push_back( { left[ i ], left[ i + 1 ], right[ i + 1 ], right[ i ] } );
+        }
+        return ret;
+    }
+
+    /// Return the width of 'sPoly' at 't'.
+    static double widthAt( const StrokePoly& sPoly, double t )
+    {
+        return ( sPoly.onSide( t, Left ) - sPoly.onSide( t, Right ) ).length();
+    }
+
+    /// Return how far the spine of 'sPoly' goes per unit of T around 't'.
+    static double spineSpeedAt( const StrokePoly& sPoly, double t )
+    {
+        const auto after = static_cast< size_t >( std::upper_bound( sPoly.t.begin(), sPoly.t.end(), t ) - sPoly.t.begin() );
+        const auto i = std::clamp< size_t >( after, 1, sPoly.pointsPerSide() - 1 ) - 1;
+        const auto spineAt = [ & ]( size_t j )
+        {
+            return ( sPoly.sides[ Left ][ j ] + sPoly.sides[ Right ][ j ] ) * 0.5;
+        };
+        return ( spineAt( i + 1 ) - spineAt( i ) ).length() / ( sPoly.t[ i + 1 ] - sPoly.t[ i ] );
+    }
+
+    /// Return where the spine of 'sPoly' lies outside the 'OutlineUnion' of drawing 'otherDId', given that
+    /// only the outlines 'otherPolysIndices' might reach it.
+    TIntervals outsideOutlineUnion( const StrokePoly& sPoly, DrawingID otherDId, const std::vector< size_t >& otherPolysIndices ) const
+    {
+        const auto numPoints = sPoly.pointsPerSide();
+        core::model::Polyline spine( numPoints );
+        for( size_t i = 0; i < numPoints; i++ ) {
+            spine[ i ] = ( sPoly.sides[ Left ][ i ] + sPoly.sides[ Right ][ i ] ) * 0.5;
+        }
+
+        // Map from the spine's parameter to 'Stroke' T.
+        const auto tFromF = [ & ]( double f )
+        {
+            const auto i = std::min( static_cast< size_t >( f ), numPoints - 2 );
+            return core::mathUtility::lerp( sPoly.t[ i ], sPoly.t[ i + 1 ], f - static_cast< double >( i ) );
+        };
+
+        TIntervals ret;
+        for( const auto& interval : outlineUnions[ otherDId ]->outsideIntervals( spine, otherPolysIndices ) ) {
+            const auto tA = tFromF( interval[ 0 ] );
+            const auto tB = tFromF( interval[ 1 ] );
+            if( tB > tA ) {
+                ret.push_back( TInterval{ tA, tB } );
+            }
+        }
+        return ret;
     }
 
     /// Return whether 'p' is inside one or more of the 'Stroke's in the indicated drawing.
@@ -68,17 +157,29 @@ struct FindTopology::Imp
         return false;
     }
 
-    /// Return values in [0,1] where the 'side' side of 'sPoly' collides with other-drawing
-    /// stroke-polys indicated by 'otherPolysIndices' (and 'otherDrawingId').
-    std::set< double > strokeSideCritT(
+    /// Append to 'storeIntersections' where the 'side' side of 'sPoly' collides with other-drawing
+    /// stroke-polys indicated by 'otherPolysIndices' (sorted; and 'otherDrawingId'), and add the
+    /// collisions' T values (in [0,1]) along 'sPoly' to 'storeCritT' if it is not null.
+    void strokeSideCritT(
                                   const StrokePoly& sPoly,
                                   StrokeSide side,
         DrawingID otherDrawingId,
-                                  const std::vector< size_t >& otherPolysIndices )
+                                  const std::vector< size_t >& otherPolysIndices,
+                                  std::vector< StrokeIntersection >& storeIntersections,
+                                  std::set< double >* storeCritT ) const
     {
         const auto& otherPolys = polys[ otherDrawingId ];
+        const auto& otherStrokeToIndex = strokeToIndex[ otherDrawingId ];
 
-        std::set< double > ret;
+        /// A crossing between a segment of 'sPoly''s side and one of 'coll''s segments.
+        struct SegHit
+        {
+            size_t otherS = 0;
+            StrokeSegColliderMetadata::SegID segID = 0;
+            Seg otherStrokeSeg;
+            Pos hitPos;
+        };
+        std::vector< SegHit > hits;
 
         for( size_t i = 0; i < sPoly.pointsPerSide() - 1; i++ ) {
 
@@ -89,76 +190,107 @@ struct FindTopology::Imp
             const auto& pB = sPoly.sides[ side ][ i + 1 ];
             const Seg seg{ pA, pB };
 
-            for( const auto otherS : otherPolysIndices ) {
-                const auto* const otherPoly = otherPolys[ otherS ];
-                otherPoly->forEachSeg(
-                            [ & ]( const Seg& otherStrokeSeg,
-                                   const Normal&,
-                                   double tA_otherStroke,
-                                   double tB_otherStroke )
+            hits.clear();
+            coll.forEachStrokeSegHit( seg,
+            [ & ]( const StrokeSegCollider::SegWithData& swd, const Pos& hitPos )
+            {
+                const auto found = otherStrokeToIndex.find( swd.metadata.stroke );
+                if( found != otherStrokeToIndex.end()
+                 && std::binary_search( otherPolysIndices.begin(), otherPolysIndices.end(), found->second ) ) {
+                    hits.push_back( { found->second, swd.metadata.segID, swd.seg, hitPos } );
+                }
+                return true;
+            } );
+
+            // In the order that visiting 'otherPolysIndices' one 'StrokePoly::forEachSeg' at a time would give.
+            std::sort( hits.begin(), hits.end(), []( const SegHit& a, const SegHit& b )
+            {
+                return std::tie( a.otherS, a.segID ) < std::tie( b.otherS, b.segID );
+            } );
+
+            for( const auto& hit : hits ) {
+                const auto& otherStrokeSeg = hit.otherStrokeSeg;
+                const auto& hitPos = hit.hitPos;
+                const auto& tOther = coll.coldMetadata( hit.segID ).t;
+
+                const auto t_myStroke = core::mathUtility::lerp( tA, tB, seg.t( hitPos ) );
+                if( storeCritT ) {
+                    storeCritT->emplace( t_myStroke );
+                }
+
+                // Record for later use
                 {
-                    Pos hitPos;
-                    if( core::mathUtility::segmentsIntersect( seg, otherStrokeSeg, hitPos ) ) {
-
-                        const auto t_myStroke = core::mathUtility::lerp( tA, tB, seg.t( hitPos ) );
-                        ret.emplace( t_myStroke );
-
-                        // Record for later use
-                        {
-                            const auto t_otherStroke = core::mathUtility::lerp(
-                                        tA_otherStroke,
-                                        tB_otherStroke,
-                                        otherStrokeSeg.t( hitPos ) );
-
-                            StrokeIntersection si;
-                            si.stroke[ 0 ] = sPoly.stroke;
-                            si.stroke[ 1 ] = otherPoly->stroke;
-                            si.t[ 0 ] = t_myStroke;
-                            si.t[ 1 ] = t_otherStroke;
-                            intersections.push_back( si );
-                        }
+                    const auto t_otherStroke = core::mathUtility::lerp(
+                                tOther[ 0 ],
+                                tOther[ 1 ],
+                                otherStrokeSeg.t( hitPos ) );
+
+                    const auto& otherPoly = *otherPolys[ hit.otherS ];
+                    StrokeIntersection si;
+                    si.stroke[ 0 ] = sPoly.stroke;
+                    si.stroke[ 1 ] = otherPoly.stroke;
+                    si.t[ 0 ] = t_myStroke;
+                    si.t[ 1 ] = t_otherStroke;
+                    if( engine == OutlineUnion ) {
+                        // The occluded intervals come from the spines instead of from these side crossings,
+                        // but a spine enters the other outline within about both widths of a crossing that
+                        // isn't grazing.
+                        const auto reach = widthAt( sPoly, t_myStroke ) + widthAt( otherPoly, t_otherStroke );
+                        si.maxTFromOccluded[ 0 ] = reach / spineSpeedAt( sPoly, t_myStroke );
+                        si.maxTFromOccluded[ 1 ] = reach / spineSpeedAt( otherPoly, t_otherStroke );
                     }
-                } );
+                    storeIntersections.push_back( si );
+                }
             }
         }
-
-        return ret;
     }
     
-    void processStroke( size_t sIndex, DrawingID dId, Topology& addTo )
+    /// What 'processStroke' finds out about one 'Stroke'.
+    struct StrokeResult
+    {
+        /// Where the 'Stroke' is not occluded by the other drawing.
+        TIntervals unoccluded;
+        std::vector< StrokeIntersection > intersections;
+    };
+
+    /// Only reads 'this', so can run concurrently with itself.
+    void processStroke( size_t sIndex, DrawingID dId, StrokeResult& store ) const
     {
-        const auto* const stroke = drawings[ dId ]->stroke( sIndex );
         const auto& sPoly = *polys[ dId ][ sIndex ];
         if( !sPoly.participates() ) {
             return;
         }
 
         const auto otherDId = otherDrawing( dId );
-        const auto& otherPolys = polys[ otherDId ];
 
-        // Determine which of 'otherPolys' we need to test against 'stroke' (partly for optimization, partly to ignore non-participating strokes).
+        // Determine which of the other drawing's polys we need to test against 'sPoly' (partly for optimization, partly to ignore non-participating strokes).
         std::vector< size_t > otherPolysIndices;
         {
             const auto& sBounds = sPoly.bounds;
-            for( size_t i = 0; i < otherPolys.size(); i++ ) {
-                if( otherPolys[ i ]->participates() ) {
-                    if( sBounds.intersects( otherPolys[ i ]->bounds ) ) {
-                        otherPolysIndices.push_back( i );
-                    }
+            for( const auto* const otherPoly : polyIndex[ otherDId ]->polysNear( sBounds ) ) {
+                if( sBounds.intersects( otherPoly->bounds ) ) {
+                    otherPolysIndices.push_back( strokeToIndex[ otherDId ].find( otherPoly->stroke )->second );
                 }
             }
+            std::sort( otherPolysIndices.begin(), otherPolysIndices.end() );
         }
 
-        // Find "critical T" values: where the sides of 'sPoly' intersect polys from 'otherPolysIndices'.
-        auto combinedT = strokeSideCritT( sPoly, Left, otherDId, otherPolysIndices );
-        const auto rightT = strokeSideCritT( sPoly, Right, otherDId, otherPolysIndices );
-        for( auto& t : rightT ) {
-            combinedT.emplace( t );
+        auto& unoccluded = store.unoccluded;
+        if( engine == OutlineUnion ) {
+            // The side crossings still go to 'store.intersections', each tagged with how far it may lie
+            // from the occluded intervals found here, but their T values are not needed.
+            strokeSideCritT( sPoly, Left, otherDId, otherPolysIndices, store.intersections, nullptr );
+            strokeSideCritT( sPoly, Right, otherDId, otherPolysIndices, store.intersections, nullptr );
+            unoccluded = outsideOutlineUnion( sPoly, otherDId, otherPolysIndices );
+            return;
         }
+
+        // Find "critical T" values: where the sides of 'sPoly' intersect polys from 'otherPolysIndices'.
+        std::set< double > combinedT;
+        strokeSideCritT( sPoly, Left, otherDId, otherPolysIndices, store.intersections, &combinedT );
+        strokeSideCritT( sPoly, Right, otherDId, otherPolysIndices, store.intersections, &combinedT );
         combinedT.emplace( 0. );
         combinedT.emplace( 1. );
-
-        TIntervals unoccluded; // for 'stroke'
         {
             boost::optional< TInterval > prog;
             auto itA = combinedT.begin();
@@ -199,43 +331,132 @@ struct FindTopology::Imp
                 unoccluded.push_back( *prog );
             }
         }
+    }
 
-        if( unoccluded.size() ) {
-            const StrokeIntervals intervals( unoccluded );
-            addTo.addStroke( *stroke, intervals );
+    /// A 'Stroke' to process: the index of its 'Drawing' and its index in it.
+    using Job = std::pair< DrawingID, size_t >;
+
+    /// Return where 'job' comes among the 'Stroke's of both drawings.
+    size_t order( const Job& job ) const
+    {
+        return job.first == DrawingID::DrawingA ? job.second : drawings[ DrawingID::DrawingA ]->numStrokes() + job.second;
+    }
+
+    /// Process 'jobs' (in parallel) and feed the results to 'topol', in order of 'jobs', so that
+    /// 'topol' comes out the same as if built serially.
+    void processInto( Topology& topol, const std::vector< Job >& jobs ) const
+    {
+        // Many more chunks than threads, since 'Stroke's vary a lot in how much work they take.
+        std::vector< StrokeResult > results( jobs.size() );
+        const auto numChunks = core::numWorkerThreads() * 16;
+        core::parallelForChunks( jobs.size(), numChunks,
+        [ & ]( size_t, size_t begin, size_t end )
+        {
+            for( auto k = begin; k < end; k++ ) {
+                processStroke( jobs[ k ].second, jobs[ k ].first, results[ k ] );
+            }
+        } );
+
+        for( size_t k = 0; k < jobs.size(); k++ ) {
+            if( results[ k ].unoccluded.size() ) {
+                const StrokeIntervals intervals( results[ k ].unoccluded );
+                topol.addStroke( *drawings[ jobs[ k ].first ]->stroke( jobs[ k ].second ), intervals, order( jobs[ k ] ) );
+            }
         }
+
+        // Now that strokes are added to 'topol', get the crossings
+        // updated by processing the intersections we've collected on the way.
+        for( const auto& result : results ) {
+            for( const auto& i : result.intersections ) {
+                topol.addStrokeIntersection( i );
+            }
+        }
+
+        topol.doneAdding();
     }
 
     std::unique_ptr< Topology > topology()
     {
-        intersections.clear();
-
-        auto ret = std::make_unique< Topology >();
+        // Every 'Stroke' of both drawings, in order.
+        std::vector< Job > jobs;
         for( size_t i = 0; i < DrawingID::NumDrawings; i++ ) {
-            const auto& drawing = drawings[ i ];
-            for( size_t j = 0; j < drawing->numStrokes(); j++ ) {
-                processStroke( j, static_cast< DrawingID >( i ), *ret );
+            for( size_t j = 0; j < drawings[ i ]->numStrokes(); j++ ) {
+                jobs.emplace_back( static_cast< DrawingID >( i ), j );
             }
         }
 
-        // Now that strokes are added to 'ret', get the crossings
-        // updated by processing the 'intersections' we've collected on the way.
-        for( const auto& i : intersections ) {
-            ret->addStrokeIntersection( i );
+        // Clip every spine against one union of each drawing's outlines rather than re-unioning the
+        // outlines near each 'Stroke'. 'updateStroke' drops these, since it only re-processes a few.
+        if( engine == OutlineUnion ) {
+            for( auto& outlineUnion : outlineUnions ) {
+                outlineUnion->cacheUnion();
+            }
         }
 
-        ret->doneAdding();
+        auto ret = std::make_unique< Topology >();
+        processInto( *ret, jobs );
         return ret;
     }
 
+    std::vector< const Crossing* > updateStroke( Topology& topol, DrawingID dId, size_t sIndex, StrokeHandle oldStroke )
+    {
+        const auto* const stroke = drawings[ dId ]->stroke( sIndex );
+        const auto polyIt = sToPoly.find( stroke );
+        if( polyIt == sToPoly.end() ) {
+            THROW_RUNTIME( "Edited 'Stroke' has no 'StrokePoly'." );
+        }
+        const auto& poly = polyIt->second;
+        const auto* const oldPoly = polys[ dId ][ sIndex ];
+        const auto oldBounds = oldPoly->bounds;
+
+        strokeToIndex[ dId ].erase( oldStroke );
+        strokeToIndex[ dId ][ stroke ] = sIndex;
+        polys[ dId ][ sIndex ] = &poly;
+        polyIndex[ dId ]->remove( oldPoly );
+        polyIndex[ dId ]->add( &poly );
+        if( engine == OutlineUnion ) {
+            outlineUnions[ dId ]->setGroup( sIndex, outlineQuads( poly ) );
+        }
+
+        // 'processStroke' only looks at other-drawing 'Stroke's whose bounds overlap, both ways, so
+        // nothing else found or was found by the edited 'Stroke', old or new.
+        const auto otherDId = otherDrawing( dId );
+        std::vector< Job > jobs{ Job{ dId, sIndex } };
+        for( const auto& bounds : { oldBounds, poly.bounds } ) {
+            for( const auto* const otherPoly : polyIndex[ otherDId ]->polysNear( bounds ) ) {
+                if( bounds.intersects( otherPoly->bounds ) ) {
+                    jobs.emplace_back( otherDId, strokeToIndex[ otherDId ].find( otherPoly->stroke )->second );
+                }
+            }
+        }
+        std::sort( jobs.begin() + 1, jobs.end() );
+        jobs.erase( std::unique( jobs.begin() + 1, jobs.end() ), jobs.end() );
+
+        topol.removeStroke( oldStroke );
+        for( size_t k = 1; k < jobs.size(); k++ ) {
+            topol.removeStroke( drawings[ otherDId ]->stroke( jobs[ k ].second ) );
+        }
+        processInto( topol, jobs );
+        return topol.changedCrossings();
+    }
+
     // Each is the same size as the number of strokes in the corresponding 'Drawing'.
     std::array< StrokePolyHandles, DrawingID::NumDrawings > polys;
+    /// From each 'Stroke' to its index in 'polys'.
+    std::array< std::unordered_map< StrokeHandle, size_t >, DrawingID::NumDrawings > strokeToIndex;
+    /// Over the participating 'polys'.
+    std::array< std::unique_ptr< StrokePolyIndex >, DrawingID::NumDrawings > polyIndex;
     const std::array< const Drawing*, DrawingID::NumDrawings > drawings;
-    std::vector< StrokeIntersection > intersections;
+    const StrokeToPoly& sToPoly;
+    const StrokeSegCollider& coll;
+    const OcclusionEngine engine;
+    /// With 'OutlineUnion', the union of each drawing's outlines.
+    std::array< std::unique_ptr< core::math::PolygonUnion >, DrawingID::NumDrawings > outlineUnions;
 };
 
-FindTopology::FindTopology( const Drawing& a, const Drawing& b, const StrokeToPoly& sToPoly )
-    : _imp( std::make_unique< Imp >( a, b, sToPoly ) )
+FindTopology::FindTopology( const Drawing& a, const Drawing& b, const StrokeToPoly& sToPoly, const StrokeSegCollider& coll,
+                            OcclusionEngine engine )
+    : _imp( std::make_unique< Imp >( a, b, sToPoly, coll, engine ) )
 {
 }
 
@@ -249,5 +470,10 @@ std::unique_ptr< Topology > FindTopology::topology()
     return ret;
 }
 
+std::vector< const Crossing* > FindTopology::updateStroke( Topology& topol, DrawingID dId, size_t sIndex, StrokeHandle oldStroke )
+{
+    return _imp->updateStroke( topol, dId, sIndex, oldStroke );
+}
+
 } // topology
 } // mashup
@@ -2,25 +2,40 @@
 #define MASHUP_TOPOLOGY_FINDTOPOLOGY_H
 
 #include <Mashup/drawing.h>
+#include <Mashup/drawingid.h>
+#include <Mashup/topology/occlusionengine.h>
 
 #include <map>
 #include <memory>
+#include <vector>
 
 namespace mashup {
 
+class StrokeSegCollider;
 struct StrokePoly;
 
 namespace topology {
 
+class Crossing;
 class Topology;
 
 class FindTopology
 {
 public:
     using StrokeToPoly = std::map< StrokeHandle, StrokePoly >;
-    FindTopology( const Drawing& a, const Drawing& b, const StrokeToPoly& );
+    /// 'coll' must hold exactly the segments of the 'StrokePoly's of 'a' and 'b' (from 'StrokeToPoly'),
+    /// and is used to find which of them cross each other.
+    FindTopology( const Drawing& a, const Drawing& b, const StrokeToPoly&, const StrokeSegCollider& coll,
+                  OcclusionEngine engine = MidpointProbes );
     ~FindTopology();
     std::unique_ptr< Topology > topology();
+
+    /// Bring 'topol' (from 'topology()') up to date with an edit of the 'Stroke' at 'sIndex' in drawing 'dId',
+    /// which used to be 'oldStroke'. The 'StrokeToPoly' and collider given to 'this' must already reflect the
+    /// edit, and 'oldStroke' and its 'StrokePoly' must still exist. Only the edited 'Stroke' and the other
+    /// drawing's 'Stroke's whose bounds overlap its old or new bounds are re-processed, and the indexes over
+    /// the drawing's 'StrokePoly's are updated in place. Return 'topol.changedCrossings()'.
+    std::vector< const Crossing* > updateStroke( Topology& topol, DrawingID dId, size_t sIndex, StrokeHandle oldStroke );
 private:
     struct Imp;
     const std::unique_ptr< Imp > _imp;
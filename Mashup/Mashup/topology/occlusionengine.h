@@ -0,0 +1,22 @@
+#ifndef MASHUP_TOPOLOGY_OCCLUSIONENGINE_H
+#define MASHUP_TOPOLOGY_OCCLUSIONENGINE_H
+
+namespace mashup {
+namespace topology {
+
+/// How 'FindTopology' decides which parts of a 'Stroke' the other drawing occludes.
+enum OcclusionEngine
+{
+    /// Split the 'Stroke' wherever its outline crosses the other drawing's outlines, and test
+    /// the rib across the middle of each piece against the other drawing's 'StrokePoly's.
+    MidpointProbes,
+    /// Union each drawing's outlines once (with Clipper2), and clip each 'Stroke''s spine
+    /// against the other drawing's union. Coarser (only the spine counts), but avoids repeated
+    /// point-in-polygon tests on dense drawings.
+    OutlineUnion
+};
+
+} // topology
+} // mashup
+
+#endif // #include
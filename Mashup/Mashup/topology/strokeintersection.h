@@ -4,6 +4,7 @@
 #include <Mashup/strokeforward.h>
 
 #include <array>
+#include <limits>
 
 namespace mashup {
 namespace topology {
@@ -12,6 +13,10 @@ struct StrokeIntersection
 {
     std::array< const Stroke*, 2 > stroke;
     std::array< double, 2 > t;
+    /// How far (in T) 't[ k ]' may lie from every occluded interval of 'stroke[ k ]' before the
+    /// intersection is taken to connect none of them, and is ignored.
+    std::array< double, 2 > maxTFromOccluded{ { std::numeric_limits< double >::infinity(),
+                                                std::numeric_limits< double >::infinity() } };
 };
 
 } // topology
@@ -8,8 +8,11 @@
 #include <Core/exceptions/runtimeerror.h>
 #include <Core/model/curveback.h>
 
-#include <list>
+#include <algorithm>
+#include <map>
 #include <set>
+#include <tuple>
+#include <vector>
 
 namespace mashup {
 namespace topology {
@@ -21,42 +24,99 @@ using Pos = core::model::Pos;
 /// Ordinally identifies some occluded interval on some 'Stroke'.
 using OccludedStrokeInterval = std::pair< StrokeHandle, size_t >;
 
-/// Combines a 'Crossing' (needed by external code) with 'occludedIntervals' (used
-/// to build topology in progress).
-struct Xing
+/// Dense, 0-based ID of one of the occluded intervals of all the 'Stroke's (each of which starts out
+/// as its own 'Crossing').
+using OccludedID = size_t;
+
+/// Union-find over 'OccludedID's, where each set is one 'Crossing' in the making. Each set is
+/// labeled by the ID that keeps the label when two sets merge (that of the first argument of
+/// 'merge'), independently of how the sets are balanced internally.
+class CrossingSets
 {
-    std::set< OccludedStrokeInterval > occludedIntervals;
-    /// Usable by outside code.
-    std::unique_ptr< Crossing > crossing;
+public:
+    /// Return the ID of a new set containing only itself.
+    OccludedID add()
+    {
+        const auto id = _parent.size();
+        _parent.push_back( id );
+        _size.push_back( 1 );
+        _label.push_back( id );
+        return id;
+    }
+
+    size_t size() const
+    {
+        return _parent.size();
+    }
+
+    /// Merge the sets of 'a' and 'b', keeping the label of 'a''s set.
+    void merge( OccludedID a, OccludedID b )
+    {
+        auto rootA = root( a );
+        auto rootB = root( b );
+        if( rootA == rootB ) {
+            return;
+        }
+        const auto label = _label[ rootA ];
+        if( _size[ rootA ] < _size[ rootB ] ) {
+            std::swap( rootA, rootB );
+        }
+        _parent[ rootB ] = rootA;
+        _size[ rootA ] += _size[ rootB ];
+        _label[ rootA ] = label;
+    }
+
+    /// Return the label of 'id''s set.
+    OccludedID label( OccludedID id )
+    {
+        return _label[ root( id ) ];
+    }
+private:
+    OccludedID root( OccludedID id )
+    {
+        while( _parent[ id ] != id ) {
+            // Path halving.
+            _parent[ id ] = _parent[ _parent[ id ] ];
+            id = _parent[ id ];
+        }
+        return id;
+    }
+
+    std::vector< OccludedID > _parent;
+    std::vector< size_t > _size;
+    std::vector< OccludedID > _label;
 };
 
-// iterators are persistent with push_back
-using Xings = std::list< Xing >;
-using XingsIt = Xings::iterator;
+/// Return how far (in T) 't' lies from 'interval' (0 if in it).
+double distToInterval( const TInterval& interval, double t )
+{
+    if( interval.contains( t ) ) {
+        return 0.;
+    }
+    return std::min< double >( std::abs( t - interval.min() ), std::abs( t - interval.max() ) );
+}
 
 /// Data for 'Stroke' 's'
 struct StrokeData
 {
-    /// Return the index of the occluded interval closest to 't', or 0 if there are
-    /// no occluded intervals.
+    /// Return the index of the occluded interval closest to 't' (the earlier one in case of a tie),
+    /// or 0 if there are no occluded intervals.
     size_t closestOccludedInterval( double t ) const
     {
-        size_t bestOccluded = 0;
-        double bestDist = std::numeric_limits< double >::max();
-        for( size_t i = 0; i < occluded.size(); i++ ) {
-            const auto& interval = occluded[ i ];
-            double distTo = 0.;
-            if( !interval.contains( t ) ) {
-                distTo = std::min< double >(
-                            std::abs( t - interval.min() ),
-                            std::abs( t - interval.max() ) );
-            }
-            if( distTo < bestDist ) {
-                bestDist = distTo;
-                bestOccluded = i;
-            }
+        // 'occluded' is sorted and its intervals are separated, so only the first interval not
+        // entirely before 't' and the one before it can be closest.
+        const auto after = static_cast< size_t >( std::partition_point( occluded.begin(), occluded.end(),
+            [ t ]( const TInterval& interval )
+            {
+                return interval.max() < t;
+            } ) - occluded.begin() );
+        if( after == occluded.size() ) {
+            return after == 0 ? 0 : after - 1;
+        }
+        if( after == 0 || occluded[ after ].contains( t ) ) {
+            return after;
         }
-        return bestOccluded;
+        return distToInterval( occluded[ after ], t ) < distToInterval( occluded[ after - 1 ], t ) ? after : after - 1;
     }
 
     /// Given 'occIdx', which corresponds to one of the 'Crossing's that 's' goes through,
@@ -77,19 +137,6 @@ struct StrokeData
         return ret;
     }
 
-    /// Assuming that 'ss' is or lies inside one of the unoccluded intervals on 's',
-    /// return a handle to the 'Router' associated with the end of 'ss' (or nullptr if
-    /// 'ss' does not end at a crossing).
-    Crossing* findCrossing( const Substroke& ss ) const
-    {
-        const auto occIdx = intervals.crossingIndex( ss );
-        if( occIdx.is_initialized() ) {
-            return xings[ *occIdx ]->crossing.get();
-        } else {
-            return nullptr;
-        }
-    }
-
     /// 'occIdx' identifies one of the occluded intervals.
     /// Return this interval expanded to include the unoccluded intervals
     /// on either side, if there.
@@ -113,8 +160,10 @@ struct StrokeData
 
     /// Sorted by increasing T.
     TIntervals occluded;
-    /// Corresponds with 'occluded'.
-    std::vector< XingsIt > xings;
+    /// 'occluded[ i ]' has 'OccludedID' 'firstOccludedID + i'.
+    OccludedID firstOccludedID = 0;
+    /// As given to 'addStroke'.
+    size_t order = 0;
 
     /// Must have size > 0, sorted by increasing T.
     TIntervals unoccluded;
@@ -126,8 +175,11 @@ struct StrokeData
 
 struct Topology::Imp
 {
-    void addStroke( const Stroke& s, const StrokeIntervals& intervals )
+    void addStroke( const Stroke& s, const StrokeIntervals& intervals, size_t order )
     {
+        touched.emplace( &s );
+        upToDate = false;
+
         if( !intervals.anyUnoccluded() ) {
             // 's' is completely occluded and should be ignored.
             return;
@@ -136,20 +188,16 @@ struct Topology::Imp
         if( strokeData.find( &s ) != strokeData.end() ) {
             THROW_RUNTIME( "Tried to addStroke redundantly" );
         }
+        if( !inOrder.emplace( order, &s ).second ) {
+            THROW_RUNTIME( "Tried to addStroke with an 'order' already taken" );
+        }
 
         auto& sData = strokeData[ &s ];
+        sData.order = order;
         sData.intervals = intervals;
         sData.occluded = sData.intervals.intervals( true );
         sData.unoccluded = sData.intervals.intervals( false );
 
-        // For every occluded interval, create a 'Crossing'
-        for( size_t i = 0; i < sData.occluded.size(); i++ ) {
-            xings.push_back( {} );
-            auto& crossing = xings.back();
-            crossing.occludedIntervals.emplace( OccludedStrokeInterval{ &s, i } );
-            sData.xings.push_back( std::next( xings.end(), -1 ) );
-        }
-
         // For every unoccluded interval, create a 'Substroke'.
         for( size_t i = 0; i < sData.unoccluded.size(); i++ ) {
             const auto& interval = sData.unoccluded[ i ];
@@ -158,6 +206,26 @@ struct Topology::Imp
     }
 
     void addStrokeIntersection( const StrokeIntersection& i )
+    {
+        reported[ i.stroke[ 0 ] ].push_back( i );
+        upToDate = false;
+    }
+
+    void removeStroke( StrokeHandle s )
+    {
+        touched.emplace( s );
+        upToDate = false;
+
+        const auto it = strokeData.find( s );
+        if( it != strokeData.end() ) {
+            inOrder.erase( it->second.order );
+            strokeData.erase( it );
+        }
+        reported.erase( s );
+    }
+
+    /// Merge the 'Crossing's that 'i' connects (if both of its 'Stroke's are known and have any).
+    void mergeAt( const StrokeIntersection& i )
     {
         const auto tA = i.t[ 0 ];
         const auto tB = i.t[ 1 ];
@@ -178,27 +246,17 @@ struct Topology::Imp
             return;
         }
 
-        const auto& aCross = aData.xings[ aData.closestOccludedInterval( tA ) ];
-        auto bCross = bData.xings[ bData.closestOccludedInterval( tB ) ];
-
-        if( aCross != bCross ) {
-            // Merge the two 'Crossings'. The one pointed at by 'aCross' becomes the merger,
-            // while the one pointed at by 'bCross' gets deleted.
-            for( const auto& p : bCross->occludedIntervals ) {
-                aCross->occludedIntervals.emplace( p );
-            }
+        // An intersection too far from either 'Stroke''s occluded intervals (e.g., where outlines only
+        // graze) would glue unrelated 'Crossing's together.
+        const auto aOccIdx = aData.closestOccludedInterval( tA );
+        const auto bOccIdx = bData.closestOccludedInterval( tB );
+        if( distToInterval( aData.occluded[ aOccIdx ], tA ) > i.maxTFromOccluded[ 0 ]
+         || distToInterval( bData.occluded[ bOccIdx ], tB ) > i.maxTFromOccluded[ 1 ] ) {
+            return;
+        }
 
-            // Any 'StrokeData' holding 'bCross' should hold 'aCross' instead.
-            for( auto& pair : strokeData ){
-                auto& data = pair.second;
-                for( auto& it : data.xings ) {
-                    if( it == bCross ) {
-                        it = aCross;
-                    }
-                }
-            }
-            xings.erase( bCross );
-        } // else these two already refer to the same 'Crossing'.
+        // The 'Crossing' of 'aData''s interval absorbs that of 'bData''s.
+        crossingSets.merge( aData.firstOccludedID + aOccIdx, bData.firstOccludedID + bOccIdx );
     }
 
     /// Return 'Substroke's representing all the unoccluded intervals of all participating
@@ -229,40 +287,137 @@ struct Topology::Imp
         return ret;
     }
 
-    /// For every 'Xing', build its contained 'Crossing'.
-    /// This should happen only once.
+    /// Group the occluded intervals of every 'Stroke' into 'Crossing's, replaying the intersections
+    /// reported so far, and build the 'Crossing's. Keep (and do not list in 'changed') each old 'Crossing'
+    /// whose occluded intervals are exactly those of one of the new ones, none from a 'touched' 'Stroke'.
     void buildCrossings()
     {
-        for( auto& xing : xings ) {
-            xing.crossing = std::make_unique< Crossing >();
-
-            // Come up with all the 'Substroke's feeding into 'xing'.
-            for( const auto& occ : xing.occludedIntervals ) {
-                const auto occIdx = occ.second;
-                const auto sDataIt = strokeData.find( occ.first );
-                if( sDataIt == strokeData.end() ) {
-                    THROW_UNEXPECTED;
+        // Give every occluded interval a new 'OccludedID', in 'order' of 'Stroke', noting where each
+        // used to be if its 'Stroke' has been left alone since last time.
+        std::vector< OccludedStrokeInterval > newOccludedIntervals;
+        std::vector< Crossing* > oldCrossingOfID;
+        crossingSets = CrossingSets();
+        for( const auto& pair : inOrder ) {
+            const auto s = pair.second;
+            auto& sData = strokeData.find( s )->second;
+            const bool wasBuilt = !touched.count( s );
+            for( size_t i = 0; i < sData.occluded.size(); i++ ) {
+                oldCrossingOfID.push_back( wasBuilt ? crossingOfID[ sData.firstOccludedID + i ] : nullptr );
+                newOccludedIntervals.push_back( OccludedStrokeInterval{ s, i } );
+            }
+            sData.firstOccludedID = crossingSets.size();
+            for( size_t i = 0; i < sData.occluded.size(); i++ ) {
+                crossingSets.add();
+            }
+        }
+
+        // How many occluded intervals each old 'Crossing' had.
+        std::map< Crossing*, size_t > oldSizes;
+        for( auto* const crossing : crossingOfID ) {
+            oldSizes[ crossing ]++;
+        }
+        std::map< Crossing*, std::unique_ptr< Crossing > > oldCrossings;
+        for( auto& crossing : crossings ) {
+            auto* const handle = crossing.get();
+            oldCrossings[ handle ] = std::move( crossing );
+        }
+
+        // Intersections reported by 'Stroke's not in 'strokeData' would be ignored anyway.
+        occludedIntervals = std::move( newOccludedIntervals );
+        for( const auto& pair : inOrder ) {
+            const auto reportedIt = reported.find( pair.second );
+            if( reportedIt != reported.end() ) {
+                for( const auto& i : reportedIt->second ) {
+                    mergeAt( i );
                 }
+            }
+        }
+
+        // Group the occluded intervals by 'Crossing' (in order of label, i.e., of when each
+        // 'Crossing' was first created), and within that by 'OccludedStrokeInterval'.
+        const auto numIDs = crossingSets.size();
+        std::vector< OccludedID > labels( numIDs );
+        std::vector< OccludedID > order( numIDs );
+        for( OccludedID id = 0; id < numIDs; id++ ) {
+            labels[ id ] = crossingSets.label( id );
+            order[ id ] = id;
+        }
+        std::sort( order.begin(), order.end(), [ & ]( OccludedID a, OccludedID b )
+        {
+            return std::tie( labels[ a ], occludedIntervals[ a ] ) < std::tie( labels[ b ], occludedIntervals[ b ] );
+        } );
+
+        crossings.clear();
+        changed.clear();
+        crossingOfID.assign( numIDs, nullptr );
+        size_t groupBegin = 0;
+        while( groupBegin < numIDs ) {
+            auto groupEnd = groupBegin + 1;
+            while( groupEnd < numIDs && labels[ order[ groupEnd ] ] == labels[ order[ groupBegin ] ] ) {
+                groupEnd++;
+            }
 
-                const auto& sData = sDataIt->second;
-                const auto substrokes = sData.substrokesPointingIntoOccluded( occIdx );
-                if( substrokes.size() == 2 ) {
-                    xing.crossing->add( substrokes[ 0 ], substrokes[ 1 ] );
-                } else if( substrokes.size() == 1 ) {
-                    xing.crossing->add( substrokes[ 0 ] );
+            // Carry over the old 'Crossing' if this group is the whole of it.
+            auto* const old = oldCrossingOfID[ order[ groupBegin ] ];
+            bool reuse = old && oldSizes[ old ] == groupEnd - groupBegin;
+            for( auto k = groupBegin; reuse && k < groupEnd; k++ ) {
+                reuse = oldCrossingOfID[ order[ k ] ] == old;
+            }
+
+            if( reuse ) {
+                crossings.push_back( std::move( oldCrossings[ old ] ) );
+            } else {
+                crossings.push_back( std::make_unique< Crossing >() );
+                changed.push_back( crossings.back().get() );
+            }
+            for( auto k = groupBegin; k < groupEnd; k++ ) {
+                crossingOfID[ order[ k ] ] = crossings.back().get();
+                if( !reuse ) {
+                    addToCrossing( *crossings.back(), occludedIntervals[ order[ k ] ] );
                 }
+            }
 
-                const auto envelopeInterval = sData.envelopeAroundOccluded( occIdx );
-                Substroke envelopeSS( *occ.first, envelopeInterval.min(), envelopeInterval.max() );
-                xing.crossing->addEnvelopeAroundOccluded( envelopeSS );
-            }            
+            groupBegin = groupEnd;
         }
+
+        touched.clear();
+        upToDate = true;
     }
 
+    /// Add to 'crossing' the 'Substroke's feeding into it from 'occ'.
+    void addToCrossing( Crossing& crossing, const OccludedStrokeInterval& occ ) const
+    {
+        const auto occIdx = occ.second;
+        const auto sDataIt = strokeData.find( occ.first );
+        if( sDataIt == strokeData.end() ) {
+            THROW_UNEXPECTED;
+        }
+
+        const auto& sData = sDataIt->second;
+        const auto substrokes = sData.substrokesPointingIntoOccluded( occIdx );
+        if( substrokes.size() == 2 ) {
+            crossing.add( substrokes[ 0 ], substrokes[ 1 ] );
+        } else if( substrokes.size() == 1 ) {
+            crossing.add( substrokes[ 0 ] );
+        }
+
+        const auto envelopeInterval = sData.envelopeAroundOccluded( occIdx );
+        Substroke envelopeSS( *occ.first, envelopeInterval.min(), envelopeInterval.max() );
+        crossing.addEnvelopeAroundOccluded( envelopeSS );
+    }
+
+    /// Assuming that 'ss' is or lies inside one of the unoccluded intervals of its 'Stroke',
+    /// return a handle to the 'Crossing' at the end of 'ss' (or nullptr if 'ss' does not end
+    /// at a crossing).
     Crossing* findCrossing( const Substroke& ss ) const
     {
-        auto it = strokeData.find( ss.stroke );
-        return it->second.findCrossing( ss );
+        const auto& sData = strokeData.find( ss.stroke )->second;
+        const auto occIdx = sData.intervals.crossingIndex( ss );
+        if( occIdx.is_initialized() ) {
+            return crossingOfID[ sData.firstOccludedID + *occIdx ];
+        } else {
+            return nullptr;
+        }
     }
 
     bool originallyConnected( const Substroke& a, const Substroke& b ) const
@@ -277,9 +432,57 @@ struct Topology::Imp
         }
     }
 
+    /// Return, for each 'OccludedID', the smallest 'OccludedID' in the same 'Crossing'.
+    std::vector< OccludedID > firstOccludedIDsOfCrossings() const
+    {
+        std::map< const Crossing*, OccludedID > firstOfCrossing;
+        std::vector< OccludedID > ret( crossingOfID.size() );
+        for( OccludedID id = 0; id < crossingOfID.size(); id++ ) {
+            ret[ id ] = firstOfCrossing.emplace( crossingOfID[ id ], id ).first->second;
+        }
+        return ret;
+    }
+
+    bool sameAs( const Imp& other ) const
+    {
+        if( inOrder != other.inOrder ) {
+            return false;
+        }
+        for( const auto& pair : strokeData ) {
+            const auto& sData = pair.second;
+            const auto& otherSData = other.strokeData.find( pair.first )->second;
+            if( sData.occluded != otherSData.occluded || sData.unoccluded != otherSData.unoccluded ) {
+                return false;
+            }
+        }
+        // With the same 'Stroke's and intervals, both give out the same 'OccludedID's.
+        return firstOccludedIDsOfCrossings() == other.firstOccludedIDsOfCrossings();
+    }
+
     /// For each 'Stroke' (of either drawing), what are the occluded and unoccluded intervals?
     std::map< StrokeHandle, StrokeData > strokeData;
-    Xings xings;
+    /// The keys of 'strokeData', by 'StrokeData::order'.
+    std::map< size_t, StrokeHandle > inOrder;
+
+    /// The 'StrokeIntersection's passed to 'addStrokeIntersection', by their 'stroke[ 0 ]', which
+    /// 'removeStroke' takes them away with.
+    std::map< StrokeHandle, std::vector< StrokeIntersection > > reported;
+
+    /// The 'Stroke's added or removed since the last 'buildCrossings'.
+    std::set< StrokeHandle > touched;
+    /// Whether nothing has been added or removed since the last 'buildCrossings'.
+    bool upToDate = false;
+
+    /// Indexed by 'OccludedID'.
+    std::vector< OccludedStrokeInterval > occludedIntervals;
+    CrossingSets crossingSets;
+
+    /// Built by 'buildCrossings', in order of creation of the first 'Crossing' that went into each.
+    std::vector< std::unique_ptr< Crossing > > crossings;
+    /// Indexed by 'OccludedID'.
+    std::vector< Crossing* > crossingOfID;
+    /// Those of 'crossings' that the last 'buildCrossings' did not carry over.
+    std::vector< const Crossing* > changed;
 };
 
 Topology::Topology() : _imp( std::make_unique< Imp >() )
@@ -290,9 +493,9 @@ Topology::~Topology()
 {
 }
 
-void Topology::addStroke( const Stroke& s, const StrokeIntervals& intervals )
+void Topology::addStroke( const Stroke& s, const StrokeIntervals& intervals, size_t order )
 {
-    _imp->addStroke( s, intervals );
+    _imp->addStroke( s, intervals, order );
 }
 
 void Topology::addStrokeIntersection( const StrokeIntersection& i )
@@ -300,6 +503,11 @@ void Topology::addStrokeIntersection( const StrokeIntersection& i )
     _imp->addStrokeIntersection( i );
 }
 
+void Topology::removeStroke( StrokeHandle s )
+{
+    _imp->removeStroke( s );
+}
+
 bool Topology::originallyConnected( const Substroke& a, const Substroke& b ) const
 {
     return _imp->originallyConnected( a, b );
@@ -317,19 +525,35 @@ void Topology::doneAdding()
 
 std::vector< const Crossing* > Topology::crossings() const
 {
+    if( !_imp->upToDate ) {
+        // Make sure buildCrossings was called.
+        THROW_UNEXPECTED;
+    }
     std::vector< const Crossing* > ret;
-    for( const auto& xing : _imp->xings ) {
-        const auto* const crossing = xing.crossing.get();
-        if( !crossing ) {
-            // Make sure buildCrossings was called.
-            THROW_UNEXPECTED;
-        } else {
-            ret.push_back( crossing );
-        }
+    for( const auto& crossing : _imp->crossings ) {
+        ret.push_back( crossing.get() );
     }
     return ret;
 }
 
+std::vector< const Crossing* > Topology::changedCrossings() const
+{
+    if( !_imp->upToDate ) {
+        // Make sure buildCrossings was called.
+        THROW_UNEXPECTED;
+    }
+    return _imp->changed;
+}
+
+bool Topology::sameAs( const Topology& other ) const
+{
+    if( !_imp->upToDate || !other._imp->upToDate ) {
+        // Make sure buildCrossings was called.
+        THROW_UNEXPECTED;
+    }
+    return _imp->sameAs( *other._imp );
+}
+
 const Crossing* Topology::findCrossing( const Substroke& ss ) const
 {
     return _imp->findCrossing( ss );
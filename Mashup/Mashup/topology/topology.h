@@ -20,6 +20,10 @@ class Crossing;
 struct StrokeIntersection;
 
 /// The layout of a drawing-blend in terms of 'Substroke's and the 'Crossing's they meet at.
+///
+/// Once built, 'this' can be updated a few 'Stroke's at a time: 'removeStroke' each, add them back
+/// (along with the intersections they report), and call 'doneAdding()' again. Only the 'Crossing's
+/// involving those 'Stroke's are rebuilt; 'changedCrossings()' tells which.
 class Topology
 {
 public:    
@@ -43,13 +47,27 @@ public:
     /// Add a 'Stroke', characterized by which intervals are occluded and which are unoccluded.
     /// Do not add the same 'Stroke' more than once.
     /// 'intervals' must be valid (increasing order, fully covers [0,1], none of the intervals overlap).
-    void addStroke( const Stroke&, const StrokeIntervals& intervals );
-    /// Call after all 'addStroke' calls. If either of the indicated 'Stroke's is not recognized by 'this',
-    /// do nothing.
+    /// 'order' (unique to the 'Stroke') ranks it, and the intersections it reports, when building the
+    /// 'Crossing's, so that the same information gives the same 'crossings()' however it was added.
+    void addStroke( const Stroke&, const StrokeIntervals& intervals, size_t order );
+    /// Record an intersection reported by (i.e., found while processing) its 'stroke[ 0 ]'. If, at the time
+    /// of 'doneAdding()', either of the indicated 'Stroke's is not recognized by 'this', it is ignored.
     void addStrokeIntersection( const StrokeIntersection& );
-    /// Signal that no more information is to be added.
+    /// Signal that no more information is to be added (for now), and build the 'Crossing's.
     void doneAdding();
 
+    /// FOR UPDATING (after 'doneAdding()')
+
+    /// Forget 's' (if added) along with the intersections it reported. Intersections reported by other
+    /// 'Stroke's are kept, so re-process every 'Stroke' that 's' had intersections with as well.
+    void removeStroke( StrokeHandle s );
+    /// Return the 'Crossing's that the last 'doneAdding()' created. The rest of 'crossings()' are carried
+    /// over unchanged (same handles) from before it, and every other 'Crossing' from before it is destroyed.
+    std::vector< const Crossing* > changedCrossings() const;
+    /// Return whether 'this' and 'other' hold the same 'Stroke's (in the same 'order'), with the same
+    /// intervals, grouped into the same 'Crossing's, however each was built and updated.
+    bool sameAs( const Topology& other ) const;
+
     /// FOR USING (after 'doneAdding()')
 
     // The purpose of 'd' is to have consistency from run to run instead of getting different orderings
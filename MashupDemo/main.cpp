@@ -38,6 +38,10 @@ void runDemo( mashupDemo::MashupInputs&& inputs )
     mashup::BlendDrawings createMashup( std::move( inputs.inputDrawings ), inputs.options, &showProg );
     createMashup.perform();
     std::cout << "\r\t\tMashup complete." << std::endl;
+    if( const auto grid = createMashup.tunedColliderGrid() ) {
+        std::cout << "\t\tAuto-tuned collider grid: " << grid->cellsWide << "x" << grid->cellsHigh
+                  << " cells of width " << grid->cellWidth << std::endl;
+    }
 
     const auto saveOutputPath = outputImagePath( inputs.name );
     mashupDemo::saveMashedUpDrawingEPS( createMashup.result(), saveOutputPath, inputs.canvasBounds );